@@ -0,0 +1,18 @@
+#ifndef __PCHAR_H
+#define __PCHAR_H
+
+#include "linux/ioctl.h"
+
+//ioctl set of the pchar core, numbers match ioctl/ioctl.h so ioctl/test.c works on core builds
+
+typedef struct{
+	short size;//total size of file
+	short avail;//free
+	short len;//filled
+}info_t;
+
+#define FIFO_CLEAR _IO('x',1)
+#define FIFO_INFO _IOR('x',2,info_t)
+#define FIFO_RESIZE _IOW('x',3,long)
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef __PCHAR_CORE_H
+#define __PCHAR_CORE_H
+
+//common pchar driver core.
+//a variant is a .c file that sets the options below and then includes this header.
+//whatever is not selected is compiled out, the hot path has no runtime switches.
+//
+//  PCHAR_DEVCNT     devices pchar0..N-1 (default 1)
+//  PCHAR_FIFO_SIZE  bytes per device, rounded up to a power of 2 by kfifo (default 32)
+//  PCHAR_BLOCKING   1 = read sleeps while empty, write sleeps while full (default 0)
+//  PCHAR_LOCKING    PCHAR_LOCK_NONE  = no locking, one reader and one writer at a time
+//                   PCHAR_LOCK_MUTEX = reads and writes are serialized per device (default)
+//                   PCHAR_LOCK_SEMA  = open is exclusive per device, as in sema/
+//  PCHAR_IOCTL      1 = FIFO_CLEAR, FIFO_INFO and FIFO_RESIZE from pchar.h, needs
+//                   PCHAR_LOCK_MUTEX (default 0)
+//
+//the modules in mutltidev/ are configurations of this core, between them every option is built:
+//  mutidev         3 devices, mutex
+//  mutidev_sema    3 devices, exclusive open, blocking
+//  mutidev_ioctl   1 device, mutex, ioctl set
+//  mutidev_nolock  1 device, no locking
+//ioctl/, wait/ and sema/ share only the registration in pchar_reg.h, their data paths
+//replaced the single kfifo per device the core is built on, and moving them here would
+//mean a hook at every line of read and write:
+//  ioctl/  no device fifo at all, each writer has its own sub-queue in a priority lane,
+//          reads pick a lane (starvation limit) and a writer in it (DRR, token buckets).
+//  wait/   the fifo holds lz4 chunks or raw bytes, a full fifo evicts instead of blocking
+//          in overwrite mode, writes can be all-or-nothing, delayed messages come from a heap.
+//  sema/   an open-coded cache-line split ring that migrates between NUMA nodes, with a
+//          BPF classifier, in-kernel links between minors, FIFO_GATHER and pchar_any.
+
+#include<linux/module.h>
+#include<linux/fs.h>
+#include<linux/cdev.h>
+#include<linux/device.h>
+#include<linux/kfifo.h>
+#include<linux/init.h>
+#include<linux/slab.h>
+#include<linux/uaccess.h>
+#include "pchar.h"
+#include "pchar_reg.h"
+
+#define PCHAR_LOCK_NONE 0
+#define PCHAR_LOCK_MUTEX 1
+#define PCHAR_LOCK_SEMA 2
+
+#ifndef PCHAR_DEVCNT
+#define PCHAR_DEVCNT 1
+#endif
+#ifndef PCHAR_FIFO_SIZE
+#define PCHAR_FIFO_SIZE 32
+#endif
+#ifndef PCHAR_BLOCKING
+#define PCHAR_BLOCKING 0
+#endif
+#ifndef PCHAR_LOCKING
+#define PCHAR_LOCKING PCHAR_LOCK_MUTEX
+#endif
+#ifndef PCHAR_IOCTL
+#define PCHAR_IOCTL 0
+#endif
+
+#if PCHAR_DEVCNT < 1
+#error "PCHAR_DEVCNT must be at least 1"
+#endif
+#if PCHAR_IOCTL && PCHAR_LOCKING != PCHAR_LOCK_MUTEX
+// the semaphore only makes open exclusive, threads sharing the file still race a resize
+#error "FIFO_RESIZE swaps the fifo under readers, PCHAR_IOCTL needs PCHAR_LOCK_MUTEX"
+#endif
+
+#if PCHAR_LOCKING == PCHAR_LOCK_MUTEX
+#include<linux/mutex.h>
+#elif PCHAR_LOCKING == PCHAR_LOCK_SEMA
+#include<linux/semaphore.h>
+#endif
+#if PCHAR_BLOCKING
+#include<linux/wait.h>
+#endif
+
+static int pchar_open(struct inode *, struct file *);
+static int pchar_close(struct inode *, struct file *);
+static ssize_t pchar_read(struct file *, char *, size_t, loff_t *);
+static ssize_t pchar_write(struct file *, const char *, size_t, loff_t *);
+#if PCHAR_IOCTL
+static long pchar_ioctl(struct file *, unsigned int, unsigned long);
+#endif
+
+//private structure
+struct pchar_device
+{
+    struct kfifo buf;
+    dev_t devno;
+    struct cdev cdev;
+#if PCHAR_LOCKING == PCHAR_LOCK_MUTEX
+    struct mutex lock;//serializes readers and writers of this device
+#elif PCHAR_LOCKING == PCHAR_LOCK_SEMA
+    struct semaphore sem;//held by the process that has the device open
+#endif
+#if PCHAR_BLOCKING
+    wait_queue_head_t rd_wq;
+    wait_queue_head_t wr_wq;
+#endif
+};
+
+#if PCHAR_LOCKING == PCHAR_LOCK_MUTEX
+#define pchar_lock(pdev) mutex_lock(&(pdev)->lock)
+#define pchar_unlock(pdev) mutex_unlock(&(pdev)->lock)
+#else
+#define pchar_lock(pdev) do { } while(0)
+#define pchar_unlock(pdev) do { } while(0)
+#endif
+
+static struct pchar_reg reg;
+static struct pchar_device devices[PCHAR_DEVCNT];
+
+static struct file_operations pchar_fops = {
+    .owner = THIS_MODULE,
+    .open = pchar_open,
+    .release = pchar_close,
+    .read = pchar_read,
+    .write = pchar_write,
+#if PCHAR_IOCTL
+    .unlocked_ioctl = pchar_ioctl,
+#endif
+};
+
+static __init int init_pchar(void)
+{
+    int ret,i;
+
+    printk(KERN_INFO "%s : init_mod() called\n",THIS_MODULE->name);
+
+    for(i=0; i<PCHAR_DEVCNT; i++)
+    {
+        ret = kfifo_alloc(&devices[i].buf, PCHAR_FIFO_SIZE, GFP_KERNEL);
+        if(ret != 0)
+        {
+            printk(KERN_ERR "%s : kfifo_alloc failed for device %d\n",THIS_MODULE->name,i);
+            goto kfifo_alloc_failed;
+        }
+#if PCHAR_LOCKING == PCHAR_LOCK_MUTEX
+        mutex_init(&devices[i].lock);
+#elif PCHAR_LOCKING == PCHAR_LOCK_SEMA
+        sema_init(&devices[i].sem, 1);
+#endif
+#if PCHAR_BLOCKING
+        init_waitqueue_head(&devices[i].rd_wq);
+        init_waitqueue_head(&devices[i].wr_wq);
+#endif
+    }
+    printk(KERN_INFO "%s : kfifo_alloc successfully created %d devices\n",THIS_MODULE->name,PCHAR_DEVCNT);
+
+    ret = pchar_reg_init(&reg, PCHAR_DEVCNT);
+    if(ret != 0)
+        goto reg_init_failed;
+    for(i=0; i<PCHAR_DEVCNT; i++)
+    {
+        devices[i].devno = MKDEV(MAJOR(reg.devno), i);
+        ret = pchar_reg_add(&reg, i, &devices[i].cdev, &pchar_fops, NULL, &devices[i], "pchar%d", i);
+        if(ret != 0)
+            goto reg_add_failed;
+    }
+
+    printk(KERN_INFO "%s : init_mod() completed\n",THIS_MODULE->name);
+    return 0;
+
+reg_add_failed:
+    pchar_reg_exit(&reg);
+reg_init_failed:
+    i = PCHAR_DEVCNT;
+kfifo_alloc_failed:
+    for(i=i-1; i>=0; i--)
+        kfifo_free(&devices[i].buf);
+    return ret;
+}
+
+static __exit void exit_pchar(void)
+{
+    int i;
+
+    printk(KERN_INFO "%s : exit_mod() called\n",THIS_MODULE->name);
+
+    pchar_reg_exit(&reg);
+
+    for(i=PCHAR_DEVCNT-1; i>=0; i--)
+        kfifo_free(&devices[i].buf);
+    printk(KERN_INFO "%s : kfifo_free() destroyed devices\n",THIS_MODULE->name);
+
+    printk(KERN_INFO "%s : exit_mod() completed\n",THIS_MODULE->name);
+}
+
+static int pchar_open(struct inode *pinode, struct file *pfile)
+{
+    struct pchar_device *pdev = container_of(pinode->i_cdev, struct pchar_device, cdev);
+
+    printk(KERN_INFO "%s : pchar_open() called\n",THIS_MODULE->name);
+    pfile->private_data = pdev;
+#if PCHAR_LOCKING == PCHAR_LOCK_SEMA
+    down(&pdev->sem);
+    printk(KERN_INFO "%s: device pchar%d lock is acquired by process %d (%s).\n", THIS_MODULE->name, MINOR(pdev->devno), get_current()->pid, get_current()->comm);
+#endif
+
+    return 0;
+}
+
+static int pchar_close(struct inode *pinode, struct file *pfile)
+{
+    struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
+
+    printk(KERN_INFO "%s : pchar_close() called\n",THIS_MODULE->name);
+#if PCHAR_LOCKING == PCHAR_LOCK_SEMA
+    up(&pdev->sem);
+#else
+    (void)pdev;
+#endif
+
+    return 0;
+}
+
+static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *poffset)
+{
+    struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
+    int nbytes,ret;
+
+    printk(KERN_INFO "%s : pchar_read() called\n",THIS_MODULE->name);
+#if PCHAR_BLOCKING
+    // interruptible sleep
+    ret = wait_event_interruptible(pdev->rd_wq, !kfifo_is_empty(&pdev->buf));
+    if(ret != 0)
+    {
+        printk(KERN_INFO "%s : pchar_read() wake-up due to signal\n",THIS_MODULE->name);
+        return -ERESTARTSYS;
+    }
+#endif
+
+    pchar_lock(pdev);
+    ret = kfifo_to_user(&pdev->buf, ubuf, size, &nbytes);
+    pchar_unlock(pdev);
+    if(ret < 0)
+    {
+        printk(KERN_ERR "%s : pchar_read() failed\n",THIS_MODULE->name);
+        return ret;
+    }
+    printk(KERN_INFO "%s : pchar_read() copied %d bytes to user space\n",THIS_MODULE->name,nbytes);
+
+#if PCHAR_BLOCKING
+    if(nbytes > 0)
+        wake_up_interruptible(&pdev->wr_wq);
+#endif
+
+    return nbytes;
+}
+
+static ssize_t pchar_write(struct file *pfile, const char *ubuf, size_t size, loff_t *poffset)
+{
+    struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
+    int nbytes,ret;
+
+    printk(KERN_INFO "%s : pchar_write() called\n",THIS_MODULE->name);
+#if PCHAR_BLOCKING
+    // interruptible sleep
+    ret = wait_event_interruptible(pdev->wr_wq, !kfifo_is_full(&pdev->buf));
+    if(ret != 0)
+    {
+        printk(KERN_INFO "%s : pchar_write() wake-up due to signal\n",THIS_MODULE->name);
+        return -ERESTARTSYS;
+    }
+#endif
+
+    pchar_lock(pdev);
+    ret = kfifo_from_user(&pdev->buf, ubuf, size, &nbytes);
+    pchar_unlock(pdev);
+    if(ret < 0)
+    {
+        printk(KERN_ERR "%s : pchar_write() failed\n",THIS_MODULE->name);
+        return ret;
+    }
+    printk(KERN_INFO "%s : pchar_write() copied %d bytes from user space\n",THIS_MODULE->name,nbytes);
+
+#if PCHAR_BLOCKING
+    if(nbytes > 0)
+        wake_up_interruptible(&pdev->rd_wq);
+#endif
+
+    return nbytes;
+}
+
+#if PCHAR_IOCTL
+// grow the fifo to size bytes keeping its contents, device lock held
+static int pchar_resize(struct pchar_device *pdev, int size)
+{
+    struct kfifo tmp;
+    char *temp;
+    int ret, len = kfifo_len(&pdev->buf);
+
+    temp = kmalloc(len,GFP_KERNEL);
+    if(temp == NULL)
+    {
+        printk(KERN_ERR  "%s: kmalloc failed()\n",THIS_MODULE->name);
+        return -ENOMEM;
+    }
+
+    ret = kfifo_alloc(&tmp,size,GFP_KERNEL);
+    if(ret != 0)
+    {
+        printk(KERN_ERR "%s: kfifo_alloc() failed\n", THIS_MODULE->name);
+        kfree(temp);
+        return ret;
+    }
+
+    ret = kfifo_out(&pdev->buf,temp,len);
+    if (ret != len)
+    {
+        printk(KERN_ERR "%s: kfifo_out() failed\n", THIS_MODULE->name);
+        kfifo_free(&tmp);
+        kfree(temp);
+        return -EIO; // Input/output error
+    }
+    kfifo_in(&tmp,temp,len);
+    kfifo_free(&pdev->buf);
+    pdev->buf = tmp;
+    kfree(temp);
+    return 0;
+}
+
+static long pchar_ioctl(struct file *pfile, unsigned int cmd, unsigned long param)
+{
+    struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
+    info_t info;
+    int ret = 0;
+
+    switch(cmd)
+    {
+        case FIFO_CLEAR:
+            printk(KERN_INFO "%s: ioctl() fifo clear\n",THIS_MODULE->name);
+            pchar_lock(pdev);
+            kfifo_reset(&pdev->buf);
+            pchar_unlock(pdev);
+#if PCHAR_BLOCKING
+            wake_up_interruptible(&pdev->wr_wq);
+#endif
+            break;
+
+        case FIFO_INFO:
+            printk(KERN_INFO "%s: ioctl() fifo info\n",THIS_MODULE->name);
+            pchar_lock(pdev);
+            info.size = kfifo_size(&pdev->buf);
+            info.avail = kfifo_avail(&pdev->buf);
+            info.len = kfifo_len(&pdev->buf);
+            pchar_unlock(pdev);
+            if(copy_to_user((void*)param, &info, sizeof(info_t)))
+                return -EFAULT;
+            break;
+
+        case FIFO_RESIZE:
+            pchar_lock(pdev);
+            ret = pchar_resize(pdev, 64);
+            pchar_unlock(pdev);
+            printk(KERN_INFO "%s: ioctl() fifo resize\n",THIS_MODULE->name);
+#if PCHAR_BLOCKING
+            if(ret == 0)
+                wake_up_interruptible(&pdev->wr_wq);
+#endif
+            break;
+
+        default:
+            printk(KERN_INFO "%s: ioctl() unsupported cmd\n",THIS_MODULE->name);
+            return -EINVAL;
+    }
+    return ret;
+}
+#endif
+
+module_init(init_pchar);
+module_exit(exit_pchar);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef __PCHAR_REG_H
+#define __PCHAR_REG_H
+
+//char device registration shared by every pchar module: one "pchar" region, the
+//"pchar_class" class, and a device node plus cdev per minor.
+//pchar_reg_exit() undoes whatever was set up, so it is also the error path of init.
+//
+//  pchar_reg_init(&reg, cnt)                                    region and class
+//  pchar_reg_add(&reg, minor, &cdev, &fops, groups, drvdata, "pchar%d", minor)   node name is printf style
+//  pchar_reg_exit(&reg)                                         minors added so far, class, region
+
+#include<linux/module.h>
+#include<linux/fs.h>
+#include<linux/cdev.h>
+#include<linux/device.h>
+#include<linux/slab.h>
+
+struct pchar_reg
+{
+    dev_t devno;//first number of the region
+    int cnt;//minors in the region
+    struct class *pclass;
+    struct cdev **cdevs;//cdev of each added minor, NULL until pchar_reg_add()
+};
+
+static inline int pchar_reg_init(struct pchar_reg *reg, int cnt)
+{
+    int ret;
+
+    reg->cnt = cnt;
+    reg->cdevs = kcalloc(cnt, sizeof(struct cdev *), GFP_KERNEL);
+    if(reg->cdevs == NULL)
+        return -ENOMEM;
+
+    ret = alloc_chrdev_region(&reg->devno, 0, cnt, "pchar");
+    if(ret != 0)
+    {
+        printk(KERN_ERR "%s : alloc_chrdev_region failed \n",THIS_MODULE->name);
+        goto alloc_chrdev_region_failed;
+    }
+    printk(KERN_INFO "%s : alloc_chrdev_region() done : devno = %d/%d\n",THIS_MODULE->name,MAJOR(reg->devno),MINOR(reg->devno));
+
+    reg->pclass = class_create(THIS_MODULE,"pchar_class");
+    if(IS_ERR(reg->pclass))
+    {
+        printk(KERN_ERR "%s : class_create() failed\n",THIS_MODULE->name);
+        ret = PTR_ERR(reg->pclass);
+        goto class_create_failed;
+    }
+    printk(KERN_INFO "%s : class_create() successfull\n",THIS_MODULE->name);
+    return 0;
+
+class_create_failed:
+    unregister_chrdev_region(reg->devno, cnt);
+alloc_chrdev_region_failed:
+    kfree(reg->cdevs);
+    reg->cdevs = NULL;
+    return ret;
+}
+
+// device node first, then the cdev that makes it live
+static inline __printf(7, 8) int pchar_reg_add(struct pchar_reg *reg, int minor, struct cdev *cdev, const struct file_operations *fops,
+        const struct attribute_group **groups, void *drvdata, const char *fmt, ...)
+{
+    struct device *pdevice;
+    dev_t devno = MKDEV(MAJOR(reg->devno), minor);
+    char name[32];
+    va_list args;
+    int ret;
+
+    va_start(args, fmt);
+    vsnprintf(name, sizeof(name), fmt, args);
+    va_end(args);
+    pdevice = device_create_with_groups(reg->pclass,NULL,devno,drvdata,groups,"%s",name);
+    if(IS_ERR(pdevice))
+    {
+        printk(KERN_ERR "%s : device_create() failed for %s\n",THIS_MODULE->name,name);
+        return PTR_ERR(pdevice);
+    }
+
+    cdev_init(cdev,fops);
+    ret = cdev_add(cdev,devno,1);
+    if(ret != 0)
+    {
+        printk(KERN_ERR "%s : cdev_add() failed for %s\n",THIS_MODULE->name,name);
+        device_destroy(reg->pclass, devno);
+        return ret;
+    }
+    reg->cdevs[minor] = cdev;
+    printk(KERN_INFO "%s : %s added as minor %d\n",THIS_MODULE->name,name,minor);
+    return 0;
+}
+
+static inline void pchar_reg_exit(struct pchar_reg *reg)
+{
+    int i;
+
+    for(i=reg->cnt-1; i>=0; i--)
+    {
+        if(reg->cdevs[i] == NULL)
+            continue;
+        cdev_del(reg->cdevs[i]);
+        device_destroy(reg->pclass, MKDEV(MAJOR(reg->devno), i));
+    }
+    printk(KERN_INFO "%s : cdev_del() and device_destroy() devices removed\n",THIS_MODULE->name);
+
+    class_destroy(reg->pclass);
+    printk(KERN_INFO "%s : class_destroy() destroyed device class\n",THIS_MODULE->name);
+
+    unregister_chrdev_region(reg->devno, reg->cnt);
+    printk(KERN_INFO "%s : unregister_chrdev_region() release device number\n",THIS_MODULE->name);
+    kfree(reg->cdevs);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef __PERIODIC_H
+#define __PERIODIC_H
+
+//periodic callbacks on hrtimers, a replacement for timer_list + mod_timer(jiffies + ticks).
+//every task has its own period in ns, well below a jiffy if needed. a task is re-armed from its
+//previous deadline, not from the time its callback ran, so the period does not drift.
+//
+//callbacks run in hrtimer context (hard irq, soft irq on PREEMPT_RT) and must not sleep.
+//they return true to run again one period later, false to stop.
+//periodic_add() and periodic_del() are for process context, e.g. module init and exit.
+
+#include<linux/hrtimer.h>
+#include<linux/ktime.h>
+#include<linux/list.h>
+#include<linux/mutex.h>
+
+#define PERIODIC_MIN_NS 10000//shorter periods would keep a cpu in timer interrupts
+
+struct periodic_task;
+typedef bool (*periodic_fn)(struct periodic_task *);
+
+struct periodic_task
+{
+    struct hrtimer timer;
+    u64 period_ns;//read at every re-arm, periodic_set_period() may change it
+    periodic_fn fn;
+    unsigned long runs;
+    unsigned long overruns;//deadlines skipped because a run came too late
+    struct list_head node;
+};
+
+static LIST_HEAD(periodic_tasks);
+static DEFINE_MUTEX(periodic_lock);//the task list
+
+static enum hrtimer_restart periodic_timer_fn(struct hrtimer *timer)
+{
+    struct periodic_task *t = container_of(timer, struct periodic_task, timer);
+    u64 orun;
+
+    t->runs++;
+    if(!t->fn(t))
+        return HRTIMER_NORESTART;
+    // next deadline on the same grid, deadlines already missed are skipped and counted
+    orun = hrtimer_forward_now(timer, ns_to_ktime(READ_ONCE(t->period_ns)));
+    t->overruns += orun - 1;
+    return HRTIMER_RESTART;
+}
+
+// first run one period from now
+static inline int periodic_add(struct periodic_task *t, u64 period_ns, periodic_fn fn)
+{
+    if(period_ns < PERIODIC_MIN_NS || fn == NULL)
+        return -EINVAL;
+    t->period_ns = period_ns;
+    t->fn = fn;
+    t->runs = 0;
+    t->overruns = 0;
+    hrtimer_init(&t->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    t->timer.function = periodic_timer_fn;
+    mutex_lock(&periodic_lock);
+    list_add_tail(&t->node, &periodic_tasks);
+    mutex_unlock(&periodic_lock);
+    hrtimer_start(&t->timer, ktime_add_ns(ktime_get(), period_ns), HRTIMER_MODE_ABS);
+    return 0;
+}
+
+// takes effect from the next deadline
+static inline int periodic_set_period(struct periodic_task *t, u64 period_ns)
+{
+    if(period_ns < PERIODIC_MIN_NS)
+        return -EINVAL;
+    WRITE_ONCE(t->period_ns, period_ns);
+    return 0;
+}
+
+// waits for a running callback, the task may be freed afterwards
+static inline void periodic_del(struct periodic_task *t)
+{
+    hrtimer_cancel(&t->timer);
+    mutex_lock(&periodic_lock);
+    list_del(&t->node);
+    mutex_unlock(&periodic_lock);
+}
+
+static inline void periodic_del_all(void)
+{
+    struct periodic_task *t, *tmp;
+    LIST_HEAD(tasks);
+
+    // take the whole list under the lock, cancel outside it since hrtimer_cancel() waits
+    mutex_lock(&periodic_lock);
+    list_splice_init(&periodic_tasks, &tasks);
+    mutex_unlock(&periodic_lock);
+    list_for_each_entry_safe(t, tmp, &tasks, node)
+    {
+        hrtimer_cancel(&t->timer);
+        list_del(&t->node);
+    }
+}
+
+#endif
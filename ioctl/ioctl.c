@@ -3,7 +3,16 @@
 #include <linux/device.h>
 #include <linux/cdev.h>
 #include <linux/kfifo.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/hrtimer.h>
+#include <linux/sched/signal.h>
+#include <linux/uaccess.h>
 #include "ioctl.h"
+#include "pchar_reg.h"
 
 static int pchar_open(struct inode *, struct file *);
 static int pchar_close(struct inode *, struct file *);
@@ -12,10 +21,40 @@ static ssize_t pchar_write(struct file *, const char *, size_t, loff_t *);
 static long pchar_ioctl(struct file *, unsigned int, unsigned long);
 
 #define MAX 32
-static struct kfifo buf;
-static dev_t devno;
-static int major;
-static struct class *pclass;
+
+//token bucket, rate 0 = unlimited
+struct tbucket
+{
+    unsigned int rate;//bytes per second
+    unsigned int burst;//bucket depth in bytes
+    unsigned int burst_cfg;//depth as set, 0 = one second worth of rate
+    u64 tokens;
+    ktime_t last;
+    unsigned long long throttled_writes;//writes cut short by the bucket
+    unsigned long long throttled_bytes;//bytes refused by the bucket
+};
+
+//per open file private structure
+struct pchar_file
+{
+    struct kfifo q;//this writer's sub-queue
+    struct list_head node;//place in its lane's round-robin list
+    int lane;//lane this file writes to, 0 = highest priority
+    int deficit;//bytes left in this writer's current turn
+    int closed;//file released, freed once its sub-queue is drained
+    struct tbucket tb;
+};
+
+static struct list_head lanes[LANES];//writers of each priority lane
+static int lane_cnt[LANES];//writers in each lane
+static int lane_bytes[LANES];//bytes queued in each lane
+static int skipped[LANES];//reads that passed over a non-empty lane
+static int starve_limit = 8;//skips after which a lane is served first, 0 = strict priority
+static int quantum = MAX;//bytes a writer may send per round
+static int qsize = MAX;//sub-queue size for new writers
+static struct tbucket dev_tb;//device wide limit
+static DEFINE_MUTEX(q_lock);//protects lanes, sub-queues and buckets
+static struct pchar_reg reg;
 static struct cdev cdev;
 static struct file_operations pchar_fops = {
     .owner = THIS_MODULE,
@@ -26,97 +65,201 @@ static struct file_operations pchar_fops = {
     .unlocked_ioctl = pchar_ioctl
 };
 
-static __init int init_mod(void)
+// refill from the time elapsed since last refill
+static void tb_refill(struct tbucket *tb)
 {
-    int ret, minor;
-    struct device *pdevice;
+    ktime_t now;
+    u64 add;
 
-    printk(KERN_INFO "%s init_mod() called\n",THIS_MODULE->name);
-    // 1) fifo
-    ret = kfifo_alloc(&buf,MAX,GFP_KERNEL);
-    if(ret != 0)
+    now = ktime_get();
+    add = mul_u64_u64_div_u64(ktime_to_ns(ktime_sub(now, tb->last)), tb->rate, NSEC_PER_SEC);
+    if(add > 0)
     {
-        printk(KERN_ERR "%s kfifo_alloc() failed\n",THIS_MODULE->name);
-        goto kfifo_alloc_failed;
+        tb->tokens = min_t(u64, tb->tokens + add, tb->burst);
+        tb->last = now;
     }
-    printk(KERN_INFO "%s kfifo_alloc() sucess\n",THIS_MODULE->name);
+}
 
-    //2) mjor minor no / device no
-    //int alloc_chrdev_region(dev_t *dev, unsigned baseminor, unsigned count, const char *name);
-    ret = alloc_chrdev_region(&devno, 0, 1,"pchar");
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s allco_chrdev_region() failed\n",THIS_MODULE->name);
-        goto allco_chrdev_region_failed;
-    }
-    major = MAJOR(devno);
-    minor = MINOR(devno);
-    printk(KERN_INFO "%s allco_chrdev_region() done : devno = %d/%d\n",THIS_MODULE->name,major,minor);
-    ///proc/devices
-    //3) device class
-    //Device class is created under /sys/class 
-    pclass = class_create(THIS_MODULE, "pchar_class");
-    if(IS_ERR(pclass))
+// a new limit starts with a full bucket, a changed one keeps the tokens it has earned
+static void tb_set(struct tbucket *tb, unsigned int rate, unsigned int burst)
+{
+    if(tb->rate != 0 && rate != 0)
+        tb_refill(tb);
+    else
     {
-        printk(KERN_ERR "%s class_create() failed\n",THIS_MODULE->name);
-        ret = -1;
-        goto class_create_failed;    
+        tb->tokens = U64_MAX;
+        tb->last = ktime_get();
     }
-    printk(KERN_INFO "%s class_create() completed\n",THIS_MODULE->name);
+    tb->rate = rate;
+    tb->burst_cfg = burst;
+    tb->burst = burst ? burst : rate;
+    tb->tokens = min_t(u64, tb->tokens, tb->burst);
+}
+
+// return how much of size may pass now
+static size_t tb_allow(struct tbucket *tb, size_t size)
+{
+    if(tb->rate == 0)
+        return size;
+    tb_refill(tb);
+    return min_t(u64, size, tb->tokens);
+}
+
+// time until the bucket holds size bytes, or as many as it can hold
+static u64 tb_wait_ns(struct tbucket *tb, size_t size)
+{
+    u64 need;
+
+    if(tb->rate == 0)
+        return 0;
+    need = min_t(u64, size, tb->burst);
+    if(tb->tokens >= need)
+        return 0;
+    return div_u64((need - tb->tokens) * NSEC_PER_SEC + tb->rate - 1, tb->rate);
+}
 
-    //4) device create
-    //Device file is create under /sys/devices/ virtual/class_name/devname and /dev/devname
-    pdevice = device_create(pclass,NULL,devno,NULL,"pchar%d",0);
-    if(IS_ERR(pdevice))
+static void tb_charge(struct tbucket *tb, size_t used, size_t refused)
+{
+    if(tb->rate == 0)
+        return;
+    tb->tokens -= used;
+    if(refused > 0)
     {
-        printk(KERN_ERR "%s device_create() failed\n",THIS_MODULE->name);
-        ret = -1;
-        goto device_create_failed;    
+        tb->throttled_writes++;
+        tb->throttled_bytes += refused;
     }
-    printk(KERN_INFO "%s device_create() completed\n",THIS_MODULE->name);
+}
 
-    //5) cdev add / add device
-    cdev_init(&cdev,&pchar_fops);
-    ret = cdev_add(&cdev,devno,1);
+static ssize_t rate_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%u\n", dev_tb.rate);
+}
+
+static ssize_t rate_store(struct device *dev, struct device_attribute *attr, const char *kbuf, size_t size)
+{
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(kbuf, 0, &val);
     if(ret != 0)
-    {
-        printk(KERN_ERR "%s cdev_add() failed\n",THIS_MODULE->name);
-        goto cdev_add_failed;
-    }
-    printk(KERN_INFO "%s cdev_add() completed\n",THIS_MODULE->name);
+        return ret;
+    mutex_lock(&q_lock);
+    tb_set(&dev_tb, val, dev_tb.burst_cfg);
+    mutex_unlock(&q_lock);
+    printk(KERN_INFO "%s: device rate limit %u bytes/s\n",THIS_MODULE->name,val);
+    return size;
+}
+
+static ssize_t burst_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%u\n", dev_tb.burst);
+}
+
+static ssize_t burst_store(struct device *dev, struct device_attribute *attr, const char *kbuf, size_t size)
+{
+    unsigned int val;
+    int ret;
+
+    ret = kstrtouint(kbuf, 0, &val);
+    if(ret != 0)
+        return ret;
+    mutex_lock(&q_lock);
+    tb_set(&dev_tb, dev_tb.rate, val);
+    mutex_unlock(&q_lock);
+    printk(KERN_INFO "%s: device burst %u bytes\n",THIS_MODULE->name,val);
+    return size;
+}
+
+static ssize_t quantum_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%d\n", quantum);
+}
+
+static ssize_t quantum_store(struct device *dev, struct device_attribute *attr, const char *kbuf, size_t size)
+{
+    int val, ret;
+
+    ret = kstrtoint(kbuf, 0, &val);
+    if(ret != 0)
+        return ret;
+    if(val <= 0)
+        return -EINVAL;
+    mutex_lock(&q_lock);
+    quantum = val;
+    mutex_unlock(&q_lock);
+    return size;
+}
+
+static ssize_t throttled_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%llu writes %llu bytes\n", dev_tb.throttled_writes, dev_tb.throttled_bytes);
+}
+
+static DEVICE_ATTR_RW(rate);
+static DEVICE_ATTR_RW(burst);
+static DEVICE_ATTR_RW(quantum);
+static DEVICE_ATTR_RO(throttled);
+
+static struct attribute *pchar_attrs[] = {
+    &dev_attr_rate.attr,
+    &dev_attr_burst.attr,
+    &dev_attr_quantum.attr,
+    &dev_attr_throttled.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(pchar);
+
+static void pchar_file_free(struct pchar_file *pf)
+{
+    list_del(&pf->node);
+    lane_cnt[pf->lane]--;
+    lane_bytes[pf->lane] -= kfifo_len(&pf->q);
+    kfifo_free(&pf->q);
+    kfree(pf);
+}
+
+static __init int init_mod(void)
+{
+    int ret, i;
+
+    printk(KERN_INFO "%s init_mod() called\n",THIS_MODULE->name);
+    // 1) lanes, sub-queues are allocated per writer in open()
+    for(i=0; i<LANES; i++)
+        INIT_LIST_HEAD(&lanes[i]);
+    tb_set(&dev_tb, 0, 0);
+    printk(KERN_INFO "%s lanes initialized\n",THIS_MODULE->name);
+
+    //2) device number, class, /dev/pchar0 and its cdev, see core/pchar_reg.h
+    //rate, burst, quantum and throttled attributes are created with the device
+    ret = pchar_reg_init(&reg, 1);
+    if(ret != 0)
+        goto reg_init_failed;
+    ret = pchar_reg_add(&reg, 0, &cdev, &pchar_fops, pchar_groups, NULL, "pchar%d", 0);
+    if(ret != 0)
+        goto reg_add_failed;
     
     printk(KERN_INFO "%s init_mod() completed\n",THIS_MODULE->name);
     return 0;
 
-cdev_add_failed:
-    device_destroy(pclass,devno);
-device_create_failed:    
-    class_destroy(pclass);
-class_create_failed:
-    unregister_chrdev_region(devno,1);
-allco_chrdev_region_failed:
-    kfifo_free(&buf);
-kfifo_alloc_failed:
+reg_add_failed:
+    pchar_reg_exit(&reg);
+reg_init_failed:
     return ret;
 }
 
 static __exit void exit_mod(void)
 {
-    printk(KERN_INFO "%s exit_mod() called\n",THIS_MODULE->name);
+    struct pchar_file *pf, *tmp;
+    int i;
 
-    cdev_del(&cdev);
-    printk(KERN_INFO "%s cdev_del() done\n",THIS_MODULE->name);
-
-    device_destroy(pclass,devno);
-    printk(KERN_INFO "%s device_destroy() done\n",THIS_MODULE->name);
-
-    class_destroy(pclass);
-    printk(KERN_INFO "%s class_destroy() done\n",THIS_MODULE->name);
+    printk(KERN_INFO "%s exit_mod() called\n",THIS_MODULE->name);
 
-    unregister_chrdev_region(devno,1);
-    printk(KERN_INFO "%s unregister_chrdev_region() done\n",THIS_MODULE->name);
+    pchar_reg_exit(&reg);
 
-    kfifo_free(&buf);
+    // sub-queues of closed writers that were never drained
+    for(i=LANES-1; i>=0; i--)
+        list_for_each_entry_safe(pf, tmp, &lanes[i], node)
+            pchar_file_free(pf);
     printk(KERN_INFO "%s kfifo_free() released\n",THIS_MODULE->name);
 
     printk(KERN_INFO "%s exit_mod() completed\n",THIS_MODULE->name);
@@ -124,100 +267,327 @@ static __exit void exit_mod(void)
 
 static int pchar_open(struct inode *pinode, struct file *pfile)
 {
+    struct pchar_file *pf;
+    int ret;
     printk(KERN_INFO "%s pchar_open()\n",THIS_MODULE->name);
 
+    pf = kzalloc(sizeof(struct pchar_file), GFP_KERNEL);
+    if(pf == NULL)
+    {
+        printk(KERN_ERR "%s pchar_open() kmalloc failed\n",THIS_MODULE->name);
+        return -ENOMEM;
+    }
+    ret = kfifo_alloc(&pf->q,qsize,GFP_KERNEL);
+    if(ret != 0)
+    {
+        printk(KERN_ERR "%s pchar_open() kfifo_alloc failed\n",THIS_MODULE->name);
+        kfree(pf);
+        return ret;
+    }
+    tb_set(&pf->tb, 0, 0);
+    pf->lane = LANES - 1;
+
+    mutex_lock(&q_lock);
+    list_add_tail(&pf->node, &lanes[pf->lane]);
+    lane_cnt[pf->lane]++;
+    mutex_unlock(&q_lock);
+    pfile->private_data = pf;
+
     return 0;
 }
 
 static int pchar_close(struct inode *pinode, struct file *pfile)
 {
+    struct pchar_file *pf = (struct pchar_file *)pfile->private_data;
     printk(KERN_INFO "%s pchar_close()\n",THIS_MODULE->name);
 
+    // data already written stays readable after the writer is gone
+    mutex_lock(&q_lock);
+    if(kfifo_is_empty(&pf->q))
+        pchar_file_free(pf);
+    else
+        pf->closed = 1;
+    mutex_unlock(&q_lock);
+    return 0;
+}
+
+// lane to drain first: a lane passed over starve_limit times, else the highest priority one
+static int pchar_first_lane(void)
+{
+    int i;
+
+    if(starve_limit > 0)
+        for(i=LANES-1; i>0; i--)
+            if(skipped[i] >= starve_limit && lane_bytes[i] > 0)
+                return i;
+    return 0;
+}
+
+// deficit round robin over the writers of one lane
+static int lane_read(int lane, char *ubuf, size_t size, int *copied)
+{
+    struct pchar_file *pf;
+    int ret, nbytes, total = 0, idle = 0;
+
+    while(total < size && idle < lane_cnt[lane])
+    {
+        pf = list_first_entry(&lanes[lane], struct pchar_file, node);
+        if(kfifo_is_empty(&pf->q))
+        {
+            pf->deficit = 0;
+            if(pf->closed)
+                pchar_file_free(pf);
+            else
+            {
+                list_move_tail(&pf->node, &lanes[lane]);
+                idle++;
+            }
+            continue;
+        }
+        idle = 0;
+
+        // new turn: the writer may send up to one quantum
+        if(pf->deficit == 0)
+            pf->deficit = quantum;
+        ret = kfifo_to_user(&pf->q,ubuf + total,min_t(size_t, size - total, pf->deficit),&nbytes);
+        if(ret < 0)
+        {
+            *copied = total;
+            return ret;
+        }
+        total += nbytes;
+        lane_bytes[lane] -= nbytes;
+        pf->deficit -= nbytes;
+        if(kfifo_is_empty(&pf->q))
+            pf->deficit = 0;
+        // turn ends when the quantum is used or the writer ran dry
+        if(pf->deficit == 0)
+            list_move_tail(&pf->node, &lanes[lane]);
+    }
+    *copied = total;
     return 0;
 }
 
 static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *poffset)
 {
-    int ret ,nbytes;
+    int ret, nbytes, total = 0, first, i, n;
+    unsigned int served = 0;
     printk(KERN_INFO "%s pchar_read()\n",THIS_MODULE->name);
 
-    ret =kfifo_to_user(&buf,ubuf,size,&nbytes);
-    if(ret < 0)
+    mutex_lock(&q_lock);
+    first = pchar_first_lane();
+    // starved lane first, then the others in priority order
+    for(n=0; n<LANES && total < size; n++)
     {
-        printk(KERN_ERR "%s pchar_read() to user failed\n",THIS_MODULE->name);
-        return ret;
+        i = n == 0 ? first : (n - 1 < first ? n - 1 : n);
+        ret = lane_read(i,ubuf + total,size - total,&nbytes);
+        total += nbytes;
+        if(ret < 0)
+        {
+            mutex_unlock(&q_lock);
+            printk(KERN_ERR "%s pchar_read() to user failed\n",THIS_MODULE->name);
+            return total > 0 ? total : ret;
+        }
+        if(nbytes > 0)
+            served |= 1 << i;
+    }
+    // lanes with data this read did not touch were passed over
+    for(i=0; i<LANES; i++)
+    {
+        if(served & (1 << i))
+            skipped[i] = 0;
+        else if(lane_bytes[i] > 0)
+            skipped[i]++;
     }
-    printk(KERN_INFO "%s pchar_read() to user success %d data copied to user\n",THIS_MODULE->name,nbytes);
+    mutex_unlock(&q_lock);
+    printk(KERN_INFO "%s pchar_read() to user success %d data copied to user\n",THIS_MODULE->name,total);
 
-    return nbytes;
+    return total;
 }
 
 static ssize_t pchar_write(struct file *pfile, const char *ubuf, size_t size, loff_t *poffset)
 {
     int ret, nbytes;
+    size_t fit, dev_ok, allowed;
+    ktime_t wait;
+    struct pchar_file *pf = (struct pchar_file *)pfile->private_data;
     printk(KERN_INFO "%s pchar_write()\n",THIS_MODULE->name);
 
-    ret = kfifo_from_user(&buf,ubuf,size,&nbytes);
+retry:
+    mutex_lock(&q_lock);
+    // device bucket first, then this writer's own bucket
+    fit = min(size, (size_t)kfifo_avail(&pf->q));
+    dev_ok = tb_allow(&dev_tb, fit);
+    allowed = tb_allow(&pf->tb, dev_ok);
+    // room in the queue but no tokens: a blocking writer sleeps until the buckets refill
+    if(fit > 0 && allowed == 0 && !(pfile->f_flags & O_NONBLOCK))
+    {
+        wait = ns_to_ktime(max(tb_wait_ns(&dev_tb, fit), tb_wait_ns(&pf->tb, fit)));
+        mutex_unlock(&q_lock);
+        set_current_state(TASK_INTERRUPTIBLE);
+        schedule_hrtimeout(&wait, HRTIMER_MODE_REL);
+        if(signal_pending(current))
+        {
+            printk(KERN_INFO "%s : pchar_write() wake-up due to signal\n",THIS_MODULE->name);
+            return -ERESTARTSYS;
+        }
+        goto retry;
+    }
+    ret = kfifo_from_user(&pf->q,ubuf,allowed,&nbytes);
     if(ret<0)
     {
+        mutex_unlock(&q_lock);
         printk(KERN_ERR "%s pchar_write() failed\n",THIS_MODULE->name);
         return ret;
     }
-    printk(KERN_INFO "%s pchar_write() success %d data copy from user\n",THIS_MODULE->name,nbytes);
-
+    lane_bytes[pf->lane] += nbytes;
+    tb_charge(&dev_tb, nbytes, fit - dev_ok);
+    tb_charge(&pf->tb, nbytes, dev_ok - allowed);
+    mutex_unlock(&q_lock);
+    printk(KERN_INFO "%s pchar_write() success %d data copy from user to lane %d\n",THIS_MODULE->name,nbytes,pf->lane);
+
+    // room in the queue but no tokens, O_NONBLOCK: throttled
+    if(fit > 0 && allowed == 0)
+        return -EAGAIN;
     return nbytes;
 }
 
+// grow one sub-queue to size bytes keeping its contents
+static int fifo_resize(struct kfifo *fifo, int size)
+{
+    struct kfifo tmp;
+    char *temp;
+    int ret, len = kfifo_len(fifo);
+
+    temp = kmalloc(len,GFP_KERNEL);
+    if(temp == NULL)
+    {
+        printk(KERN_ERR  "%s: kmalloc failed()\n",THIS_MODULE->name);
+        return -ENOMEM;
+    }
+
+    ret = kfifo_alloc(&tmp,size,GFP_KERNEL);
+    if(ret != 0)
+    {
+        printk(KERN_ERR "%s: kfifo_alloc() failed\n", THIS_MODULE->name);
+        kfree(temp);
+        return ret;
+    }
+
+    ret = kfifo_out(fifo,temp,len);
+    if (ret != len)
+    {
+        printk(KERN_ERR "%s: kfifo_out() failed\n", THIS_MODULE->name);
+        kfifo_free(&tmp);
+        kfree(temp);
+        return -EIO; // Input/output error
+    }
+    kfifo_in(&tmp,temp,len);
+    kfifo_free(fifo);
+    *fifo = tmp;
+    kfree(temp);
+    return 0;
+}
+
 static long pchar_ioctl(struct file *pfile, unsigned int cmd, unsigned long param)
 {
+    struct pchar_file *pf = (struct pchar_file *)pfile->private_data;
+    struct pchar_file *p;
     info_t info;
-    
+    rate_t rate;
+    stats_t stats;
+    int ret = 0, i, val;
+
     switch(cmd)
     {
         case FIFO_CLEAR:
             printk(KERN_INFO "%s: ioctl() fifo clear\n",THIS_MODULE->name);
-            kfifo_reset(&buf);
+            mutex_lock(&q_lock);
+            for(i=0; i<LANES; i++)
+            {
+                list_for_each_entry(p, &lanes[i], node)
+                    kfifo_reset(&p->q);
+                lane_bytes[i] = 0;
+            }
+            mutex_unlock(&q_lock);
             break;
 
         case FIFO_INFO:
             printk(KERN_INFO "%s: ioctl() fifo info\n",THIS_MODULE->name);
-            info.size = kfifo_size(&buf);
-            info.avail = kfifo_avail(&buf);
-            info.len = kfifo_len(&buf);
-            copy_to_user((void*)param, &info,sizeof(info_t));
+            info.size = info.avail = info.len = 0;
+            mutex_lock(&q_lock);
+            for(i=0; i<LANES; i++)
+            {
+                list_for_each_entry(p, &lanes[i], node)
+                {
+                    info.size += kfifo_size(&p->q);
+                    info.avail += kfifo_avail(&p->q);
+                    info.len += kfifo_len(&p->q);
+                }
+            }
+            mutex_unlock(&q_lock);
+            if(copy_to_user((void*)param, &info,sizeof(info_t)))
+                return -EFAULT;
             break;
 
         case FIFO_RESIZE:
-            static char *temp;
-            int ret;
-            int len = kfifo_len(&buf);
+            mutex_lock(&q_lock);
+            qsize = 64;
+            for(i=0; i<LANES && ret == 0; i++)
+                list_for_each_entry(p, &lanes[i], node)
+                    if((ret = fifo_resize(&p->q,qsize)) != 0)
+                        break;
+            mutex_unlock(&q_lock);
+            if(ret != 0)
+                return ret;
+            printk(KERN_INFO "%s: ioctl() fifo resize\n",THIS_MODULE->name);
+            break;
 
-            temp = kmalloc(len,GFP_KERNEL);
-            if(temp == NULL)
-            {
-                ret = -ENOMEM;
-                printk(KERN_ERR  "%s: kmalloc failed()\n",THIS_MODULE->name);
-            }
+        case FIFO_SET_LANE:
+            if(copy_from_user(&val, (void*)param, sizeof(val)))
+                return -EFAULT;
+            if(val < 0 || val >= LANES)
+                return -EINVAL;
+            mutex_lock(&q_lock);
+            lane_cnt[pf->lane]--;
+            lane_bytes[pf->lane] -= kfifo_len(&pf->q);
+            pf->lane = val;
+            pf->deficit = 0;
+            list_move_tail(&pf->node, &lanes[val]);
+            lane_cnt[val]++;
+            lane_bytes[val] += kfifo_len(&pf->q);
+            mutex_unlock(&q_lock);
+            printk(KERN_INFO "%s: ioctl() writes go to lane %d\n",THIS_MODULE->name,val);
+            break;
 
-            ret = kfifo_out(&buf,temp,len);
-            if (ret != len) 
-            {
-                printk(KERN_ERR "%s: kfifo_out() failed\n", THIS_MODULE->name);
-                kfree(temp);
-                return -EIO; // Input/output error
-            }
-            kfifo_free(&buf);
+        case FIFO_SET_STARVE:
+            if(copy_from_user(&val, (void*)param, sizeof(val)))
+                return -EFAULT;
+            if(val < 0)
+                return -EINVAL;
+            starve_limit = val;
+            printk(KERN_INFO "%s: ioctl() starvation limit %d\n",THIS_MODULE->name,val);
+            break;
 
-            ret = kfifo_alloc(&buf,64,GFP_KERNEL);
-            if(ret != 0) 
-            {
-                printk(KERN_ERR "%s: kfifo_alloc() failed\n", THIS_MODULE->name);
-            }
-            
-            kfifo_in(&buf,temp,64);
-            kfree(temp);
-            printk(KERN_INFO "%s: ioctl() fifo resize\n",THIS_MODULE->name);
-            
+        case FIFO_SET_RATE:
+            if(copy_from_user(&rate, (void*)param, sizeof(rate_t)))
+                return -EFAULT;
+            mutex_lock(&q_lock);
+            tb_set(&pf->tb, rate.rate, rate.burst);
+            mutex_unlock(&q_lock);
+            printk(KERN_INFO "%s: ioctl() writer rate limit %u bytes/s burst %u\n",THIS_MODULE->name,rate.rate,rate.burst);
+            break;
+
+        case FIFO_GET_STATS:
+            mutex_lock(&q_lock);
+            stats.dev_throttled_writes = dev_tb.throttled_writes;
+            stats.dev_throttled_bytes = dev_tb.throttled_bytes;
+            stats.throttled_writes = pf->tb.throttled_writes;
+            stats.throttled_bytes = pf->tb.throttled_bytes;
+            mutex_unlock(&q_lock);
+            if(copy_to_user((void*)param, &stats, sizeof(stats_t)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() fifo stats\n",THIS_MODULE->name);
             break;
 
         default:
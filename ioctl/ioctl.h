@@ -3,15 +3,33 @@
 
 #include "linux/ioctl.h"
 
+#define LANES 4//priority lanes per device, 0 = highest
+
 typedef struct{
 	short size;//total size of file
 	short avail;//free
 	short len;//filled
 }info_t;
 
+typedef struct{
+	unsigned int rate;//bytes per second, 0 = unlimited
+	unsigned int burst;//bucket depth in bytes, 0 = one second worth of rate
+}rate_t;
+
+typedef struct{
+	unsigned long long dev_throttled_writes;//writes cut short by the device limit
+	unsigned long long dev_throttled_bytes;
+	unsigned long long throttled_writes;//writes cut short by this file's limit
+	unsigned long long throttled_bytes;
+}stats_t;
+
 
 #define FIFO_CLEAR _IO('x',1)
 #define FIFO_INFO _IOR('x',2,info_t)
 #define FIFO_RESIZE _IOW('x',3,long)
+#define FIFO_SET_LANE _IOW('x',12,int)//lane for this file's writes
+#define FIFO_SET_STARVE _IOW('x',13,int)//reads a queued lane may be passed over before it goes first, 0 = strict priority
+#define FIFO_SET_RATE _IOW('x',14,rate_t)//token bucket for this file's writes
+#define FIFO_GET_STATS _IOR('x',15,stats_t)//throttling statistics
 
 #endif
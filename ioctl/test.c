@@ -1,4 +1,5 @@
 #include<stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -9,12 +10,16 @@ int main(int argc, char *argv[])
 {
 	int fd,ret;
 
-	if(argc!=2)
+	if(argc<2)
 	{
 		printf("invalid usage\n");
 		printf("usage1: %s clear\n",argv[0]);
 		printf("usage2: %s info\n", argv[0]);
 		printf("usage3: %s resize\n", argv[0]);
+		printf("usage4: %s lane <lane> <data>\n", argv[0]);
+		printf("usage5: %s starve <limit>\n", argv[0]);
+		printf("usage6: %s rate <bytes_per_sec> <burst> <data>\n", argv[0]);
+		printf("usage7: %s stats\n", argv[0]);
 		_exit(2);
 	}
 
@@ -52,13 +57,71 @@ int main(int argc, char *argv[])
 		else
 			printf("fifo resized\n");
 	}
+	else if(strcmp(argv[1],"lane")==0 && argc==4)
+	{
+		int lane = atoi(argv[2]);
+
+		ret = ioctl(fd, FIFO_SET_LANE, &lane);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+		{
+			ret = write(fd, argv[3], strlen(argv[3]));
+			printf("wrote %d bytes to lane %d\n",ret,lane);
+		}
+	}
+	else if(strcmp(argv[1],"starve")==0 && argc==3)
+	{
+		int limit = atoi(argv[2]);
 
+		ret = ioctl(fd, FIFO_SET_STARVE, &limit);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("starvation limit set to %d\n",limit);
+	}
+	else if(strcmp(argv[1],"rate")==0 && argc==5)
+	{
+		rate_t rate;
+		int i;
+
+		rate.rate = atoi(argv[2]);
+		rate.burst = atoi(argv[3]);
+		ret = ioctl(fd, FIFO_SET_RATE, &rate);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+		{
+			for(i=0; i<10; i++)
+			{
+				ret = write(fd, argv[4], strlen(argv[4]));
+				if(ret < 0)
+					perror("write() throttled");
+				else
+					printf("wrote %d bytes\n",ret);
+			}
+		}
+	}
+	else if(strcmp(argv[1],"stats")==0)
+	{
+		stats_t stats;
+
+		ret = ioctl(fd, FIFO_GET_STATS, &stats);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("fifo stats : device throttled %llu writes %llu bytes, file throttled %llu writes %llu bytes\n",stats.dev_throttled_writes,stats.dev_throttled_bytes,stats.throttled_writes,stats.throttled_bytes);
+	}
 	else
 	{
 		printf("invalid usage\n");
 		printf("usage1: %s clear\n", argv[0]);
 		printf("usage2: %s info\n",argv[0]);
 		printf("usage3: %s resize\n", argv[0]);
+		printf("usage4: %s lane <lane> <data>\n", argv[0]);
+		printf("usage5: %s starve <limit>\n", argv[0]);
+		printf("usage6: %s rate <bytes_per_sec> <burst> <data>\n", argv[0]);
+		printf("usage7: %s stats\n", argv[0]);
 	}
 	close(fd);
 	return 0;
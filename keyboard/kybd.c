@@ -1,42 +1,68 @@
 #include <linux/module.h>
-#include <linux/timer.h>
 #include <linux/io.h>
+#include "periodic.h"
 
 //#define KBD_DATA_REG           0x60    /* I/O port for keyboard data */
 //#define KBD_CONTROL_REG        0x64 
 
-struct timer_list mytimer;
-int ticks;
+//two independent periodic tasks on hrtimers, periods in us so sub-ms rates work
+static unsigned int count_us = 10000000;
+module_param(count_us, uint, 0444);
+MODULE_PARM_DESC(count_us, "period of the counter in us");
+static unsigned int kbd_us = 10000000;
+module_param(kbd_us, uint, 0444);
+MODULE_PARM_DESC(kbd_us, "period of the keyboard enable command in us");
+
+struct periodic_task count_task, kbd_task;
 int count = 0;
 
 
 
 
-void mytimer_function(struct timer_list *ptimer)
+bool count_function(struct periodic_task *ptask)
 {
-	printk(KERN_INFO " %s : mytimer_function : count = %d\n", THIS_MODULE->name, count);
+	printk(KERN_INFO " %s : count_function : count = %d\n", THIS_MODULE->name, count);
 	count++;
-	mod_timer(&mytimer, jiffies + ticks);
+	return true;
+}
+
+bool kbd_function(struct periodic_task *ptask)
+{
 	outb(0xAE, 0x60);
+	return true;
 }
 
 static __init int desd_init(void)
 {
-	int sec = 10;
-	ticks = sec * HZ;		//750
+	int ret;
+
+	// reject bad periods before the keyboard is disabled
+	if((u64)count_us * NSEC_PER_USEC < PERIODIC_MIN_NS || (u64)kbd_us * NSEC_PER_USEC < PERIODIC_MIN_NS)
+		return -EINVAL;
 	outb(0xAD, 0x64);
-	timer_setup(&mytimer, mytimer_function, 0);
-	mytimer.expires = jiffies + ticks;
-	add_timer(&mytimer);
+	ret = periodic_add(&count_task, (u64)count_us * NSEC_PER_USEC, count_function);
+	if(ret != 0)
+		goto count_add_failed;
+	ret = periodic_add(&kbd_task, (u64)kbd_us * NSEC_PER_USEC, kbd_function);
+	if(ret != 0)
+		goto kbd_add_failed;
 
 	printk(KERN_INFO " %s : Timer initialisation is done successfully\n", THIS_MODULE->name);
 	
 	return 0;
+
+kbd_add_failed:
+	periodic_del(&count_task);
+count_add_failed:
+	// never leave the keyboard disabled without a module to enable it again
+	outb(0xAE, 0x64);
+	return ret;
 }
 
 static __exit void desd_exit(void)
 {
-	del_timer_sync(&mytimer);
+	periodic_del_all();
+	printk(KERN_INFO " %s : count ran %lu times, %lu overruns\n", THIS_MODULE->name, count_task.runs, count_task.overruns);
 	printk(KERN_INFO " %s : Timer deinitialisation is done successfully\n", THIS_MODULE->name);
 }
 module_init(desd_init);
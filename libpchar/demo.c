@@ -0,0 +1,89 @@
+#include<stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include "libpchar.h"
+
+int main(int argc, char *argv[])
+{
+	char names[16][PCHAR_NAME_MAX];
+	struct iovec recs[PCHAR_BATCH_MAX];
+	char bufs[PCHAR_BATCH_MAX][256];
+	pchar_t *p;
+	info_t info;
+	int i, cnt;
+
+	if(argc<2 || (strcmp(argv[1],"list") != 0 && argc<3))
+	{
+		printf("invalid usage\n");
+		printf("usage1: %s list\n",argv[0]);
+		printf("usage2: %s info <dev>\n",argv[0]);
+		printf("usage3: %s send <dev> <record>...\n",argv[0]);
+		printf("usage4: %s recv <dev>\n",argv[0]);
+		_exit(2);
+	}
+
+	if(strcmp(argv[1],"list") == 0)
+	{
+		cnt = pchar_list(names, 16);
+		if(cnt < 0)
+		{
+			perror("pchar_list() failed");
+			_exit(1);
+		}
+		for(i=0; i<cnt; i++)
+			printf("%s\n", names[i]);
+		return 0;
+	}
+
+	p = pchar_open(argv[2], O_RDWR);
+	if(p == NULL)
+	{
+		perror("pchar_open() failed");
+		_exit(1);
+	}
+	printf("transport: %s\n", pchar_transport(p) == PCHAR_IO_VEC ? "readv/writev" : "read/write");
+
+	if(strcmp(argv[1],"info") == 0)
+	{
+		if(pchar_info(p, &info) != 0)
+			perror("pchar_info() failed");
+		else
+			printf("size: %d, avail: %d, len: %d\n", info.size, info.avail, info.len);
+	}
+	else if(strcmp(argv[1],"send") == 0)
+	{
+		cnt = argc - 3 < PCHAR_BATCH_MAX ? argc - 3 : PCHAR_BATCH_MAX;
+		for(i=0; i<cnt; i++)
+		{
+			recs[i].iov_base = argv[3 + i];
+			recs[i].iov_len = strlen(argv[3 + i]);
+		}
+		if(pchar_send_records(p, recs, cnt) < 0)
+			perror("pchar_send_records() failed");
+		else
+			printf("sent %d records\n", cnt);
+	}
+	else if(strcmp(argv[1],"recv") == 0)
+	{
+		for(i=0; i<PCHAR_BATCH_MAX; i++)
+		{
+			recs[i].iov_base = bufs[i];
+			recs[i].iov_len = sizeof(bufs[i]) - 1;
+		}
+		cnt = pchar_recv_records(p, recs, PCHAR_BATCH_MAX);
+		if(cnt < 0)
+			perror("pchar_recv_records() failed");
+		for(i=0; i<cnt; i++)
+		{
+			bufs[i][recs[i].iov_len] = '\0';
+			printf("record %d: %s\n", i, bufs[i]);
+		}
+	}
+	else
+		printf("invalid command\n");
+
+	pchar_close(p);
+	return 0;
+}
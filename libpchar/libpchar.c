@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "libpchar.h"
+
+#define PCHAR_CLASS "/sys/class/pchar_class"
+#define HDR sizeof(uint16_t)
+#define TX_SIZE 4096//staging buffer of the read/write transport
+#define RX_SIZE (2 * (HDR + PCHAR_RECORD_MAX))//always room for one whole record
+#define BACKOFF_MS 1//fifo full and the driver's poll does not report room
+
+struct pchar
+{
+	int fd;
+	enum pchar_io io;
+	char *tx;//PCHAR_IO_RW only
+	size_t tx_len;
+	char *rx;//rx[0] is always the start of a record header
+	size_t rx_len;
+};
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+int pchar_list(char names[][PCHAR_NAME_MAX], int max)
+{
+	DIR *dir;
+	struct dirent *de;
+	int cnt = 0;
+
+	dir = opendir(PCHAR_CLASS);
+	if(dir == NULL)
+		return -1;
+	while(cnt < max && (de = readdir(dir)) != NULL)
+	{
+		if(strncmp(de->d_name, "pchar", 5) != 0)
+			continue;
+		snprintf(names[cnt], PCHAR_NAME_MAX, "%.*s", PCHAR_NAME_MAX - 1, de->d_name);
+		cnt++;
+	}
+	closedir(dir);
+	qsort(names, cnt, PCHAR_NAME_MAX, name_cmp);
+	return cnt;
+}
+
+pchar_t *pchar_open(const char *name, int flags)
+{
+	char path[PCHAR_NAME_MAX + 8];
+	const char *io;
+	pchar_t *p;
+
+	p = calloc(1, sizeof(pchar_t));
+	if(p == NULL)
+		return NULL;
+	p->rx = malloc(RX_SIZE);
+	if(p->rx == NULL)
+		goto rx_alloc_failed;
+
+	if(strchr(name, '/') == NULL)
+	{
+		snprintf(path, sizeof(path), "/dev/%s", name);
+		name = path;
+	}
+	p->fd = open(name, flags);
+	if(p->fd < 0)
+		goto open_failed;
+
+	//every character device takes readv/writev, the kernel loops over the segments
+	//for drivers without iter ops, which still saves a syscall per record.
+	//none of the pchar drivers implement mmap, so there is no shared ring to map.
+	p->io = PCHAR_IO_VEC;
+	io = getenv("LIBPCHAR_IO");
+	if(io != NULL && strcmp(io, "rw") == 0)
+		p->io = PCHAR_IO_RW;
+	if(p->io == PCHAR_IO_RW)
+	{
+		p->tx = malloc(TX_SIZE);
+		if(p->tx == NULL)
+			goto tx_alloc_failed;
+	}
+	return p;
+
+tx_alloc_failed:
+	close(p->fd);
+open_failed:
+	free(p->rx);
+rx_alloc_failed:
+	free(p);
+	return NULL;
+}
+
+void pchar_close(pchar_t *p)
+{
+	close(p->fd);
+	free(p->tx);
+	free(p->rx);
+	free(p);
+}
+
+int pchar_fd(pchar_t *p)
+{
+	return p->fd;
+}
+
+enum pchar_io pchar_transport(pchar_t *p)
+{
+	return p->io;
+}
+
+int pchar_info(pchar_t *p, info_t *info)
+{
+	int ret = ioctl(p->fd, FIFO_INFO, info);
+
+	//the drivers answer unknown commands with EINVAL
+	if(ret < 0 && errno == EINVAL)
+		errno = ENOTTY;
+	return ret;
+}
+
+ssize_t pchar_send(pchar_t *p, const void *buf, size_t len)
+{
+	return write(p->fd, buf, len);
+}
+
+ssize_t pchar_recv(pchar_t *p, void *buf, size_t len)
+{
+	return read(p->fd, buf, len);
+}
+
+//sleep until the fifo has room. drivers without a poll method always look writable,
+//a write that still fails right after poll() said POLLOUT backs off for BACKOFF_MS instead.
+static int wait_writable(pchar_t *p, int polled)
+{
+	struct pollfd pfd = { p->fd, POLLOUT, 0 };
+	int ret;
+
+	do
+		ret = polled ? poll(NULL, 0, BACKOFF_MS) : poll(&pfd, 1, -1);
+	while(ret < 0 && errno == EINTR);
+	return ret < 0 ? -1 : 0;
+}
+
+//write every segment, waiting out a full fifo
+static int writev_all(pchar_t *p, struct iovec *iov, int cnt)
+{
+	ssize_t ret;
+	int polled = 0;
+
+	while(cnt > 0)
+	{
+		ret = writev(p->fd, iov, cnt);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret < 0 && errno != EAGAIN)
+			return -1;
+		if(ret <= 0)
+		{
+			if(wait_writable(p, polled) < 0)
+				return -1;
+			polled = 1;
+			continue;
+		}
+		polled = 0;
+		while(cnt > 0 && (size_t)ret >= iov->iov_len)
+		{
+			ret -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+static int write_all(pchar_t *p, const char *buf, size_t len)
+{
+	struct iovec iov = { (void *)buf, len };
+
+	return writev_all(p, &iov, 1);
+}
+
+static int tx_flush(pchar_t *p)
+{
+	int ret = write_all(p, p->tx, p->tx_len);
+
+	p->tx_len = 0;
+	return ret;
+}
+
+//copy small pieces into the staging buffer, large ones go straight out
+static int tx_put(pchar_t *p, const void *buf, size_t len)
+{
+	if(p->tx_len + len > TX_SIZE && tx_flush(p) < 0)
+		return -1;
+	if(len >= TX_SIZE)
+		return write_all(p, buf, len);
+	memcpy(p->tx + p->tx_len, buf, len);
+	p->tx_len += len;
+	return 0;
+}
+
+int pchar_send_records(pchar_t *p, const struct iovec *recs, int n)
+{
+	struct iovec iov[2 * PCHAR_BATCH_MAX];
+	uint16_t hdr[PCHAR_BATCH_MAX];
+	int i, cnt, done;
+
+	for(i=0; i<n; i++)
+	{
+		if(recs[i].iov_len > PCHAR_RECORD_MAX)
+		{
+			errno = EMSGSIZE;
+			return -1;
+		}
+	}
+
+	for(done=0; done<n; done+=cnt)
+	{
+		cnt = n - done < PCHAR_BATCH_MAX ? n - done : PCHAR_BATCH_MAX;
+		for(i=0; i<cnt; i++)
+		{
+			hdr[i] = recs[done + i].iov_len;
+			iov[2*i].iov_base = &hdr[i];
+			iov[2*i].iov_len = HDR;
+			iov[2*i+1] = recs[done + i];
+		}
+
+		if(p->io == PCHAR_IO_VEC)
+		{
+			if(writev_all(p, iov, 2 * cnt) < 0)
+				return -1;
+			continue;
+		}
+		for(i=0; i<2*cnt; i++)
+			if(tx_put(p, iov[i].iov_base, iov[i].iov_len) < 0)
+				return -1;
+	}
+	if(p->io == PCHAR_IO_RW && p->tx_len > 0 && tx_flush(p) < 0)
+		return -1;
+	return n;
+}
+
+//hand out complete records from the receive buffer
+static int rx_parse(pchar_t *p, struct iovec *recs, int n)
+{
+	size_t off = 0;
+	uint16_t len;
+	int got = 0;
+
+	while(got < n && p->rx_len - off >= HDR)
+	{
+		memcpy(&len, p->rx + off, HDR);
+		if(p->rx_len - off - HDR < len)
+			break;
+		if(len > recs[got].iov_len)
+		{
+			//leave it buffered, the caller can retry with a bigger buffer
+			if(got == 0)
+				errno = EMSGSIZE;
+			break;
+		}
+		memcpy(recs[got].iov_base, p->rx + off + HDR, len);
+		recs[got].iov_len = len;
+		off += HDR + len;
+		got++;
+	}
+	memmove(p->rx, p->rx + off, p->rx_len - off);
+	p->rx_len -= off;
+	return got;
+}
+
+int pchar_recv_records(pchar_t *p, struct iovec *recs, int n)
+{
+	ssize_t ret;
+	int got;
+
+	errno = 0;
+	got = rx_parse(p, recs, n);
+	if(got == n || errno == EMSGSIZE)
+		return got > 0 ? got : -1;
+
+	//one read per call, blocking drivers sleep here, the others return what they have
+	do
+		ret = read(p->fd, p->rx + p->rx_len, RX_SIZE - p->rx_len);
+	while(ret < 0 && errno == EINTR);
+	if(ret < 0)
+		return got > 0 ? got : -1;
+	p->rx_len += ret;
+
+	errno = 0;
+	got += rx_parse(p, recs + got, n - got);
+	if(got == 0 && errno == EMSGSIZE)
+		return -1;
+	return got;
+}
@@ -0,0 +1,41 @@
+#ifndef __LIBPCHAR_H
+#define __LIBPCHAR_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "pchar.h"
+
+//userspace client for the pchar devices.
+//raw calls move plain bytes, record calls frame each record with a 2 byte length
+//so message boundaries survive the byte stream of the fifo.
+//
+//one writer per device: the drivers have no write_iter, so the kernel issues one write per
+//iovec segment and a full fifo takes part of a record. records sent by two processes, or two
+//threads, at the same time can interleave. a pchar_t is not thread safe either.
+
+#define PCHAR_NAME_MAX 32
+#define PCHAR_RECORD_MAX 65535
+#define PCHAR_BATCH_MAX 64//records per vectored call
+
+//transport picked by pchar_open(), cheapest first
+enum pchar_io{
+	PCHAR_IO_VEC,//readv/writev, one syscall per batch
+	PCHAR_IO_RW,//read/write through a user space staging buffer
+};
+
+typedef struct pchar pchar_t;
+
+int pchar_list(char names[][PCHAR_NAME_MAX], int max);//pchar devices registered in sysfs, returns count
+pchar_t *pchar_open(const char *name, int flags);//"pchar0" or a path, flags as for open(2)
+void pchar_close(pchar_t *p);
+int pchar_fd(pchar_t *p);
+enum pchar_io pchar_transport(pchar_t *p);
+int pchar_info(pchar_t *p, info_t *info);//FIFO_INFO, -1/ENOTTY on drivers without it
+
+ssize_t pchar_send(pchar_t *p, const void *buf, size_t len);//raw, may be short
+ssize_t pchar_recv(pchar_t *p, void *buf, size_t len);//raw, may be short
+
+int pchar_send_records(pchar_t *p, const struct iovec *recs, int n);//all n records or -1, waits in poll() while the fifo is full
+int pchar_recv_records(pchar_t *p, struct iovec *recs, int n);//complete records received, iov_len set to each length
+
+#endif
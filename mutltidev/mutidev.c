@@ -1,194 +1,8 @@
-#include<linux/module.h>
-#include<linux/fs.h>
-#include<linux/cdev.h>
-#include<linux/device.h>
-#include<linux/kfifo.h>
-#include<linux/init.h>
-#include<linux/slab.h>
-
-static int pchar_open(struct inode *, struct file *);
-static int pchar_close(struct inode *, struct file *);
-static ssize_t pchar_read(struct file *, char *, size_t, loff_t *);
-static ssize_t pchar_write(struct file *, const char *, size_t, loff_t *);
-
-#define MAX 32
-
-//private structure
-struct pchar_device
-{
-    static struct kfifo buf;
-    dev_t devno;
-    static struct cdev cdev;
-}
-
-static int major;
-static struct class *pclass;
-static int devcnt = 3;
-struct pchar_device *devices;
-
-static struct file_operations pchar_fops = {
-    .owner = THIS_MODULE,
-    .read = pchar_read,
-    .write = pchar_write,
-    .open = pchar_open,
-    .release = pchar_close
-};
-
-static __init int init_pchar(void)
-{
-    int ret,minor;
-    struct device *pdevice;
-    dev_t devno;
-
-    printk(KERN_INFO "%s : init_mod() called\n",THIS_MODULE->name);
-
-    devices = (struct pchar_device*)kmalloc(devcnt * sizeof(struct pchar_device), GFP_KERNEL);
-    if(devices == NULL)
-    {
-        ret = -ENOMEM;
-        printk(KERN_ERR "%s kmalloc() failed to allocate memory\n",THIS_MODULE->name);
-        goto devices_kmalloc_failed;
-    }
-    printk(KERN_INFO "%s kmalloc() allocated devices\n",THIS_MODULE->name);
-
-
-    for(i=0; i<devcnt; i++)
-    {
-        ret = kfifo_alloc(&devices[i].buf, MAX, GFP_KERNEL);
-        if(ret != 0)
-        {
-            printk(KERN_ERR "%s : kfifo_alloc failed \n",THIS_MODULE->name);
-            goto kfifo_alloc_failed;
-        }
-        printk(KERN_INFO "%s : kfifo_alloc successfully created %d devices\n",THIS_MODULE->name,devcnt);
-    }
-
-    ret = alloc_chrdev_region(&devno, 0, 1,"pchar");
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s : alloc_chrdev_region failed \n",THIS_MODULE->name);
-        goto alloc_chrdev_region_failed;
-    }
-    major = MAJOR(devno);
-    minor = MINOR(devno);
-    printk(KERN_INFO "%s : alloc_chrdev_region() done : devno = %d/%d\n",THIS_MODULE->name,major,minor);
-
-    pclass = class_create(THIS_MODULE,"pchar_class");
-    if(IS_ERR(pclass))
-    {
-        printk(KERN_ERR "%s : class_create() failed\n",THIS_MODULE->name);
-        goto class_create_failed;
-    }
-    printk(KERN_INFO "%s : class_create() successfull\n",THIS_MODULE->name);
-    
-    pdevice = device_create(pclass,NULL,devno,NULL,"pchar%d",0);
-    if(IS_ERR(pdevice))
-    {
-        printk(KERN_ERR "%s : device_create() failed\n",THIS_MODULE->name);
-        goto device_create_failed;
-    }
-    printk(KERN_INFO "%s : device_create() successfull\n",THIS_MODULE->name);
-
-    cdev_init(&cdev,&pchar_fops);
-    ret = cdev_add(&cdev,devno,1);
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s : cdev_add() failed\n",THIS_MODULE->name);
-        goto cdev_add_failed;
-    }
-    printk(KERN_INFO "%s : cdev_add() successfull\n",THIS_MODULE->name);
-
-    printk(KERN_INFO "%s : init_mod() completed\n",THIS_MODULE->name);
-    return 0;
-
-cdev_add_failed:
-    device_destroy(pclass,devno);
-device_create_failed:
-    class_destroy(pclass);
-class_create_failed:
-    unregister_chrdev_region(devno,1);
-alloc_chrdev_region_failed:
-    kfifo_free(&buf);
-kfifo_alloc_failed:
-    for(i=i-1; i>=0; i--)
-        kfifo_free(&devices[i],buf);
-    kfree(devices);
-devices_kmalloc_failed:
-    return ret;
-
-}
-
-static __exit void exit_pchar(void)
-{
-    printk(KERN_INFO "%s : exit_mod() called\n",THIS_MODULE->name);
-
-    cdev_del(&cdev);
-    printk(KERN_INFO "%s : cdev_del() device removed\n",THIS_MODULE->name);
-
-    device_destroy(pclass,devno);
-    printk(KERN_INFO "%s : device_destroy() device removed\n",THIS_MODULE->name);
-
-    class_destroy(pclass);
-    printk(KERN_INFO "%s : class_destroy() destroyed device class\n",THIS_MODULE->name);
-
-    unregister_chrdev_region(devno,1);
-    printk(KERN_INFO "%s : unregister_chrdev_region() release device number\n",THIS_MODULE->name);
-
-    kfifo_free(&buf);
-    printk(KERN_INFO "%s : kfifo_free() destroyed device\n",THIS_MODULE->name);
-    
-    printk(KERN_INFO "%s : exit_mod() completed\n",THIS_MODULE->name);
-}
-
-static int pchar_open(struct inode *pinode, struct file *pfile)
-{
-    printk(KERN_INFO "%s : pchar_open() called\n",THIS_MODULE->name);
-
-    return 0;
-}
-
-static int pchar_close(struct inode *pinode, struct file *pfile)
-{
-    printk(KERN_INFO "%s : pchar_close() called\n",THIS_MODULE->name);
-
-    return 0;
-}
-
-static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *poffset)
-{
-    int nbytes,ret;
-
-    printk(KERN_INFO "%s : pchar_read() called\n",THIS_MODULE->name);
-    ret = kfifo_to_user(&buf, ubuf, size, &nbytes);
-    if(ret < 0)
-    {
-        printk(KERN_ERR "%s : pchar_read() failed\n",THIS_MODULE->name);
-        return ret;
-    }
-    printk(KERN_INFO "%s : pchar_read() copied %d bytes to user space\n",THIS_MODULE->name,nbytes);
-
-    return nbytes;
-}
-
-static ssize_t pchar_write(struct file *pfile, const char *ubuf, size_t size, loff_t *poffset)
-{
-    int nbytes,ret;
-
-    printk(KERN_INFO "%s : pchar_write() called\n",THIS_MODULE->name);
-    ret = kfifo_from_user(&buf, ubuf, size, &nbytes);
-    if(ret < 0)
-    {
-        printk(KERN_ERR "%s : pchar_write() failed\n",THIS_MODULE->name);
-        return ret;
-    }
-    printk(KERN_INFO "%s : pchar_write() copied %d bytes from user space\n",THIS_MODULE->name,nbytes);
-
-    return nbytes;
-}
-
-module_init(init_pchar);
-module_exit(exit_pchar);
+//three independent fifo devices pchar0..pchar2, built from the common core
+#define PCHAR_DEVCNT 3
+#define PCHAR_LOCKING PCHAR_LOCK_MUTEX
+#include "pchar_core.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("akash");
-MODULE_DESCRIPTION("try3 mod");
\ No newline at end of file
+MODULE_DESCRIPTION("try3 mod");
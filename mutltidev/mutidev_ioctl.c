@@ -0,0 +1,10 @@
+//ioctl/ semantics on the common core: a single pchar0 with FIFO_CLEAR, FIFO_INFO and FIFO_RESIZE,
+//ioctl/test.c and libpchar's pchar_info() run against it
+#define PCHAR_DEVCNT 1
+#define PCHAR_LOCKING PCHAR_LOCK_MUTEX
+#define PCHAR_IOCTL 1
+#include "pchar_core.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("akash");
+MODULE_DESCRIPTION("pchar core with the fifo ioctls");
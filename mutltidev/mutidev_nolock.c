@@ -0,0 +1,9 @@
+//lock-free build of the common core: kfifo is safe for one reader and one writer,
+//pchar0 is for a single producer and a single consumer only
+#define PCHAR_DEVCNT 1
+#define PCHAR_LOCKING PCHAR_LOCK_NONE
+#include "pchar_core.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("akash");
+MODULE_DESCRIPTION("pchar core without locking");
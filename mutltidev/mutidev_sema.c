@@ -0,0 +1,10 @@
+//sema/ and wait/ semantics on the common core: each of pchar0..pchar2 is open by one
+//process at a time, reads sleep while the fifo is empty and writes while it is full
+#define PCHAR_DEVCNT 3
+#define PCHAR_LOCKING PCHAR_LOCK_SEMA
+#define PCHAR_BLOCKING 1
+#include "pchar_core.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("akash");
+MODULE_DESCRIPTION("pchar core, exclusive open and blocking io");
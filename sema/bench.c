@@ -0,0 +1,284 @@
+//producer/consumer throughput and cache line traffic across pchar devices.
+//one writer and one reader thread per device, each pinned to its own cpu.
+//every thread counts its own cache events with perf_event_open(), user and kernel side,
+//so the driver's shared lines show up. needs root or kernel.perf_event_paranoid <= 1.
+//
+//build: gcc -O2 -pthread -o bench bench.c
+//before/after a layout change:
+//	insmod old/sema.ko; ./bench -o before.txt; rmmod sema
+//	insmod new/sema.ko; ./bench -c before.txt
+//-c prints both runs per MB moved, so different throughputs still compare.
+//
+//cross-core transfers (HITM) have no generic event, pass the raw code of the cpu with -r:
+//	intel skylake and later: -r 0x04d2 (MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM)
+//	perf list --details | grep -i hitm shows the code on other cpus
+//perf c2c record ./bench && perf c2c report names the contended lines themselves.
+#define _GNU_SOURCE
+#include<stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define DEVS 3
+#define MSG 8
+
+enum { C_REFS, C_MISSES, C_L1D_MISSES, C_HITM, NCOUNTERS };
+static const char *counter_names[NCOUNTERS] = { "cache-references", "cache-misses", "L1-dcache-load-misses", "hitm" };
+
+struct worker
+{
+	int fd;
+	int cpu;
+	int writer;
+	unsigned long long bytes;
+	long long counts[NCOUNTERS];//-1 = counter not available
+};
+
+static volatile int stop;
+static long long hitm_raw = -1;
+
+static int counter_open(int c)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	switch(c)
+	{
+	case C_REFS:
+		attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+		break;
+	case C_MISSES:
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case C_L1D_MISSES:
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	case C_HITM:
+		if(hitm_raw < 0)
+			return -1;
+		attr.type = PERF_TYPE_RAW;
+		attr.config = hitm_raw;
+		break;
+	}
+	//this thread only, on whatever cpu it runs, counting from now
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char buf[MSG];
+	cpu_set_t set;
+	int ret, c, fds[NCOUNTERS];
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	for(c=0; c<NCOUNTERS; c++)
+		fds[c] = counter_open(c);
+
+	memset(buf, 'x', sizeof(buf));
+	while(!stop)
+	{
+		ret = w->writer ? write(w->fd, buf, sizeof(buf)) : read(w->fd, buf, sizeof(buf));
+		if(ret < 0)
+		{
+			perror(w->writer ? "write() failed" : "read() failed");
+			break;
+		}
+		w->bytes += ret;
+	}
+
+	for(c=0; c<NCOUNTERS; c++)
+	{
+		w->counts[c] = -1;
+		if(fds[c] < 0)
+			continue;
+		ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+		if(read(fds[c], &w->counts[c], sizeof(w->counts[c])) != sizeof(w->counts[c]))
+			w->counts[c] = -1;
+		close(fds[c]);
+	}
+	return NULL;
+}
+
+//totals of one run: bytes read by all readers, then one value per counter
+struct result
+{
+	int secs;
+	unsigned long long bytes;
+	long long counts[NCOUNTERS];
+};
+
+static int result_save(const char *path, struct result *r)
+{
+	FILE *fp;
+	int c;
+
+	fp = fopen(path, "w");
+	if(fp == NULL)
+		return -1;
+	fprintf(fp, "secs %d\n", r->secs);
+	fprintf(fp, "bytes %llu\n", r->bytes);
+	for(c=0; c<NCOUNTERS; c++)
+		fprintf(fp, "%s %lld\n", counter_names[c], r->counts[c]);
+	fclose(fp);
+	return 0;
+}
+
+static int result_load(const char *path, struct result *r)
+{
+	FILE *fp;
+	char name[64];
+	long long val;
+	int c;
+
+	fp = fopen(path, "r");
+	if(fp == NULL)
+		return -1;
+	r->secs = 1;
+	r->bytes = 0;
+	for(c=0; c<NCOUNTERS; c++)
+		r->counts[c] = -1;
+	while(fscanf(fp, "%63s %lld", name, &val) == 2)
+	{
+		if(strcmp(name, "secs") == 0 && val > 0)
+			r->secs = val;
+		if(strcmp(name, "bytes") == 0)
+			r->bytes = val;
+		for(c=0; c<NCOUNTERS; c++)
+			if(strcmp(name, counter_names[c]) == 0)
+				r->counts[c] = val;
+	}
+	fclose(fp);
+	return 0;
+}
+
+static double per_mb(long long count, unsigned long long bytes)
+{
+	return bytes ? (double)count * (1 << 20) / bytes : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker w[2*DEVS];
+	pthread_t th[2*DEVS];
+	struct result res, base;
+	const char *save = NULL, *cmp = NULL;
+	char path[32];
+	int i, c, opt, secs = 5, ncpu;
+
+	while((opt = getopt(argc, argv, "s:r:o:c:")) != -1)
+	{
+		switch(opt)
+		{
+		case 's':
+			secs = atoi(optarg);
+			break;
+		case 'r':
+			hitm_raw = strtoll(optarg, NULL, 0);
+			break;
+		case 'o':
+			save = optarg;
+			break;
+		case 'c':
+			cmp = optarg;
+			break;
+		default:
+			printf("usage: %s [-s secs] [-r raw hitm event] [-o save.txt] [-c baseline.txt]\n", argv[0]);
+			_exit(2);
+		}
+	}
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	//open each device once, sema allows a single opener, both threads share the fd
+	for(i=0; i<DEVS; i++)
+	{
+		sprintf(path, "/dev/pchar%d", i);
+		w[2*i].fd = w[2*i+1].fd = open(path, O_RDWR);
+		if(w[2*i].fd < 0)
+		{
+			perror("open() failed");
+			_exit(1);
+		}
+	}
+
+	for(i=0; i<2*DEVS; i++)
+	{
+		w[i].cpu = i % ncpu;
+		w[i].writer = (i % 2) == 0;
+		w[i].bytes = 0;
+		pthread_create(&th[i], NULL, worker_fn, &w[i]);
+	}
+
+	sleep(secs);
+	stop = 1;
+	for(i=0; i<2*DEVS; i++)
+		pthread_join(th[i], NULL);
+
+	memset(&res, 0, sizeof(res));
+	res.secs = secs;
+	for(i=0; i<DEVS; i++)
+	{
+		printf("pchar%d: wrote %llu bytes (cpu %d), read %llu bytes (cpu %d), %.0f reads/sec\n",
+			i, w[2*i].bytes, w[2*i].cpu, w[2*i+1].bytes, w[2*i+1].cpu,
+			(double)w[2*i+1].bytes / MSG / secs);
+		res.bytes += w[2*i+1].bytes;
+		close(w[2*i].fd);
+	}
+	for(c=0; c<NCOUNTERS; c++)
+	{
+		for(i=0; i<2*DEVS; i++)
+		{
+			if(w[i].counts[c] < 0)
+			{
+				res.counts[c] = -1;
+				break;
+			}
+			res.counts[c] += w[i].counts[c];
+		}
+	}
+
+	printf("%-24s %16s %14s\n", "counter", "total", "per MB read");
+	for(c=0; c<NCOUNTERS; c++)
+	{
+		if(res.counts[c] < 0)
+			printf("%-24s %16s\n", counter_names[c], c == C_HITM && hitm_raw < 0 ? "(no -r)" : "n/a (no pmu or paranoid)");
+		else
+			printf("%-24s %16lld %14.1f\n", counter_names[c], res.counts[c], per_mb(res.counts[c], res.bytes));
+	}
+
+	if(save != NULL && result_save(save, &res) < 0)
+		perror("save failed");
+	if(cmp != NULL)
+	{
+		if(result_load(cmp, &base) < 0)
+		{
+			perror("baseline load failed");
+			return 1;
+		}
+		printf("\n%-24s %14s %14s %9s\n", "per MB read", "baseline", "this run", "change");
+		for(c=0; c<NCOUNTERS; c++)
+		{
+			double b = per_mb(base.counts[c], base.bytes), n = per_mb(res.counts[c], res.bytes);
+
+			if(base.counts[c] < 0 || res.counts[c] < 0)
+				continue;
+			printf("%-24s %14.1f %14.1f %8.1f%%\n", counter_names[c], b, n, b > 0 ? 100.0 * (n - b) / b : 0);
+		}
+		printf("%-24s %14.1f %14.1f\n", "MB/s", (double)base.bytes / (1 << 20) / base.secs,
+			(double)res.bytes / (1 << 20) / secs);
+	}
+	return 0;
+}
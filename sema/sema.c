@@ -2,49 +2,264 @@
 #include<linux/fs.h>
 #include<linux/cdev.h>
 #include<linux/device.h>
-#include<linux/kfifo.h>
 #include<linux/init.h>
 #include<linux/slab.h>
 #include<linux/semaphore.h>
+#include<linux/mutex.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include<linux/uaccess.h>
+#include<linux/rcupdate.h>
+#include<linux/skbuff.h>
+#include<linux/bpf.h>
+#include<linux/filter.h>
+#include<linux/cache.h>
+#include<linux/numa.h>
+#include<linux/nodemask.h>
+#include<linux/topology.h>
+#include "sema.h"
+#include "pchar_reg.h"
 
 static int pchar_open(struct inode *, struct file *);
+static int pchar_any_open(struct inode *, struct file *);
 static int pchar_close(struct inode *, struct file *);
 static ssize_t pchar_read(struct file *, char *, size_t, loff_t *);
 static ssize_t pchar_write(struct file *, const char *, size_t, loff_t *);
+static long pchar_ioctl(struct file *, unsigned int, unsigned long);
+static __poll_t pchar_poll(struct file *, poll_table *);
 
-#define MAX 32
+#define MAX 32//ring size, must be a power of 2
 
-//private structure
+//per-node traffic of one device, readers and writers count on separate lines
+struct pchar_node_stats
+{
+    unsigned long rd_bytes ____cacheline_aligned_in_smp;//under rd_lock
+    unsigned long wr_bytes ____cacheline_aligned_in_smp;//under lock
+};
+
+//private structure, one separately allocated cache-line aligned object per device.
+//the ring is open coded instead of a kfifo so producer and consumer indices
+//live on their own lines and a transfer does not bounce one line between cores.
 struct pchar_device
 {
-    struct kfifo buf;
+    // read-mostly: ring geometry and routing, looked up on every call
+    char *data;
+    unsigned int mask;//ring size - 1
+    int node;//numa node the ring lives on
+    int placed;//0 = move the ring to the node of the next reader
+    struct pchar_node_stats *stats;//nr_node_ids entries
     dev_t devno;
-    struct cdev cdev;
+    struct pchar_device *fwd;//next pipeline stage, NULL = not linked
+    struct bpf_prog __rcu *filter;//socket filter run on each write, NULL = accept all
+
+    // producer side: only writers store here
+    unsigned int in ____cacheline_aligned_in_smp;
+    struct mutex lock;//serializes producers, forwarded writes share the target fifo
+
+    // consumer side: only readers store here
+    unsigned int out ____cacheline_aligned_in_smp;
+    struct mutex rd_lock;//serializes consumers, gather reads drain devices they did not open
+
+    // woken by producers and consumers, slept on by poll()
+    wait_queue_head_t rd_wq ____cacheline_aligned_in_smp;
+
+    // open/close and registration only
+    struct cdev cdev ____cacheline_aligned_in_smp;
     struct semaphore sem;
 };
 
-static int major;
-static struct class *pclass;
+static struct pchar_reg reg;
 static int devcnt = 3;
-struct pchar_device *devices;
+static struct kmem_cache *pchar_cache;
+struct pchar_device **devices;
+static DEFINE_MUTEX(link_lock);//protects fwd links of all devices
+static DECLARE_WAIT_QUEUE_HEAD(gather_wq);//woken when any device gets data
+static DECLARE_WAIT_QUEUE_HEAD(any_wq);//woken when any device is closed
+static struct cdev any_cdev;//pchar_any, minor devcnt
+
+#define ring_size(pdev) ((pdev)->mask + 1)
+// ring storage padded to whole cache lines. kmalloc aligns power of 2 sizes to their size,
+// so no two rings share a line, which a 32 byte ring in kmalloc-32 would.
+#define ring_alloc_size(size) ALIGN(size, L1_CACHE_BYTES)
+
+static unsigned int ring_len(struct pchar_device *pdev)
+{
+    return READ_ONCE(pdev->in) - READ_ONCE(pdev->out);
+}
+
+static unsigned int ring_avail(struct pchar_device *pdev)
+{
+    return ring_size(pdev) - ring_len(pdev);
+}
+
+#define ring_is_empty(pdev) (ring_len(pdev) == 0)
+#define ring_is_full(pdev) (ring_avail(pdev) == 0)
+
+// producer, pdev->lock held
+static unsigned int ring_in(struct pchar_device *pdev, const char *kbuf, unsigned int len)
+{
+    unsigned int in = pdev->in, off = in & pdev->mask, l;
+
+    len = min(len, ring_size(pdev) - (in - smp_load_acquire(&pdev->out)));
+    l = min(len, ring_size(pdev) - off);
+    memcpy(pdev->data + off, kbuf, l);
+    memcpy(pdev->data, kbuf + l, len - l);
+    // data must be visible before the index that publishes it
+    smp_store_release(&pdev->in, in + len);
+    return len;
+}
+
+// producer, pdev->lock held
+static int ring_from_user(struct pchar_device *pdev, const char *ubuf, size_t size, int *copied)
+{
+    unsigned int in = pdev->in, off = in & pdev->mask, l, len;
+
+    len = min_t(size_t, size, ring_size(pdev) - (in - smp_load_acquire(&pdev->out)));
+    l = min(len, ring_size(pdev) - off);
+    *copied = 0;
+    if(copy_from_user(pdev->data + off, ubuf, l) || copy_from_user(pdev->data, ubuf + l, len - l))
+        return -EFAULT;
+    smp_store_release(&pdev->in, in + len);
+    *copied = len;
+    return 0;
+}
+
+// consumer, pdev->rd_lock held
+static unsigned int ring_out(struct pchar_device *pdev, char *kbuf, unsigned int len)
+{
+    unsigned int out = pdev->out, off = out & pdev->mask, l;
+
+    len = min(len, smp_load_acquire(&pdev->in) - out);
+    l = min(len, ring_size(pdev) - off);
+    memcpy(kbuf, pdev->data + off, l);
+    memcpy(kbuf + l, pdev->data, len - l);
+    // slots are handed back only after the data was copied out
+    smp_store_release(&pdev->out, out + len);
+    return len;
+}
+
+// consumer, pdev->rd_lock held
+static int ring_to_user(struct pchar_device *pdev, char *ubuf, size_t size, int *copied)
+{
+    unsigned int out = pdev->out, off = out & pdev->mask, l, len;
+
+    len = min_t(size_t, size, smp_load_acquire(&pdev->in) - out);
+    l = min(len, ring_size(pdev) - off);
+    *copied = 0;
+    if(copy_to_user(ubuf, pdev->data + off, l) || copy_to_user(ubuf + l, pdev->data, len - l))
+        return -EFAULT;
+    smp_store_release(&pdev->out, out + len);
+    *copied = len;
+    return 0;
+}
+
+// move the ring to node keeping its contents, rd_lock then lock as in pchar_flush
+static int pchar_migrate(struct pchar_device *pdev, int node)
+{
+    char *data, *old;
+
+    data = kmalloc_node(ring_alloc_size(ring_size(pdev)), GFP_KERNEL, node);
+    if(data == NULL)
+        return -ENOMEM;
+
+    mutex_lock(&pdev->rd_lock);
+    mutex_lock(&pdev->lock);
+    // indices are free running, the same offsets stay valid in the new ring
+    memcpy(data, pdev->data, ring_size(pdev));
+    old = pdev->data;
+    pdev->data = data;
+    // kmalloc_node() falls back to other nodes when node is short of memory
+    pdev->node = page_to_nid(virt_to_page(data));
+    WRITE_ONCE(pdev->placed, 1);
+    mutex_unlock(&pdev->lock);
+    mutex_unlock(&pdev->rd_lock);
+
+    kfree(old);
+    printk(KERN_INFO "%s: pchar%d ring placed on node %d\n",THIS_MODULE->name,MINOR(pdev->devno),pdev->node);
+    return 0;
+}
+
+static ssize_t numa_node_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    struct pchar_device *pdev = dev_get_drvdata(dev);
+
+    return sprintf(kbuf, "%d%s\n", pdev->node, READ_ONCE(pdev->placed) ? "" : " (follows next reader)");
+}
+
+// node >= 0 pins the ring there, -1 lets the next reader pull it to its own node
+static ssize_t numa_node_store(struct device *dev, struct device_attribute *attr, const char *kbuf, size_t size)
+{
+    struct pchar_device *pdev = dev_get_drvdata(dev);
+    int val, ret;
+
+    ret = kstrtoint(kbuf, 0, &val);
+    if(ret != 0)
+        return ret;
+    if(val == NUMA_NO_NODE)
+    {
+        WRITE_ONCE(pdev->placed, 0);
+        return size;
+    }
+    if(val < 0 || val >= nr_node_ids || !node_online(val))
+        return -EINVAL;
+    ret = pchar_migrate(pdev, val);
+    return ret < 0 ? ret : size;
+}
+
+// bytes moved by readers and writers running on each node, * marks the ring's node
+static ssize_t node_stats_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    struct pchar_device *pdev = dev_get_drvdata(dev);
+    int node, len = 0;
+
+    for_each_online_node(node)
+        len += sysfs_emit_at(kbuf, len, "node%d%s rd %lu wr %lu\n", node, node == pdev->node ? "*" : "",
+                READ_ONCE(pdev->stats[node].rd_bytes), READ_ONCE(pdev->stats[node].wr_bytes));
+    return len;
+}
+
+static DEVICE_ATTR_RW(numa_node);
+static DEVICE_ATTR_RO(node_stats);
+
+static struct attribute *pchar_attrs[] = {
+    &dev_attr_numa_node.attr,
+    &dev_attr_node_stats.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(pchar);
 
 static struct file_operations pchar_fops = {
     .owner = THIS_MODULE,
     .open = pchar_open,
     .release = pchar_close,
     .read = pchar_read,
-    .write = pchar_write
+    .write = pchar_write,
+    .unlocked_ioctl = pchar_ioctl,
+    .poll = pchar_poll
+};
+
+// pchar_any only binds the file to a channel, pchar_fops takes over from there
+static struct file_operations pchar_any_fops = {
+    .owner = THIS_MODULE,
+    .open = pchar_any_open
 };
 
 static __init int init_pchar(void)
 {
-    int ret,minor,i;
-    struct device *pdevice;
-    dev_t devno;
+    int ret,i;
 
     printk(KERN_INFO "%s : init_mod() called\n",THIS_MODULE->name);
 
-    devices = (struct pchar_device*)kmalloc(devcnt * sizeof(struct pchar_device), GFP_KERNEL);
+    // cache-line aligned slab so no two devices share a line
+    pchar_cache = KMEM_CACHE(pchar_device, SLAB_HWCACHE_ALIGN);
+    if(pchar_cache == NULL)
+    {
+        ret = -ENOMEM;
+        printk(KERN_ERR "%s kmem_cache_create() failed\n",THIS_MODULE->name);
+        goto cache_create_failed;
+    }
+
+    devices = kcalloc(devcnt, sizeof(struct pchar_device *), GFP_KERNEL);
     if(devices == NULL)
     {
         ret = -ENOMEM;
@@ -55,88 +270,73 @@ static __init int init_pchar(void)
 
     for(i=0; i<devcnt; i++)
     {
-        ret = kfifo_alloc(&devices[i].buf, MAX, GFP_KERNEL);
-        if(ret != 0)
+        ret = -ENOMEM;
+        devices[i] = kmem_cache_zalloc(pchar_cache, GFP_KERNEL);
+        if(devices[i] == NULL)
         {
-            printk(KERN_ERR "%s : kfifo_alloc failed for device %d\n",THIS_MODULE->name,i);
-            goto kfifo_alloc_failed;
+            printk(KERN_ERR "%s : kmem_cache_zalloc failed for device %d\n",THIS_MODULE->name,i);
+            goto ring_alloc_failed;
         }
-        printk(KERN_INFO "%s : kfifo_alloc successfully created %d devices\n",THIS_MODULE->name,devcnt);
-    }
-
-    ret = alloc_chrdev_region(&devno, 0, devcnt,"pchar");
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s : alloc_chrdev_region failed \n",THIS_MODULE->name);
-        goto alloc_chrdev_region_failed;
-    }
-    major = MAJOR(devno);
-    minor = MINOR(devno);
-    printk(KERN_INFO "%s : alloc_chrdev_region() done : devno = %d/%d\n",THIS_MODULE->name,major,minor);
-
-    pclass = class_create(THIS_MODULE,"pchar_class");
-    if(IS_ERR(pclass))
-    {
-        printk(KERN_ERR "%s : class_create() failed\n",THIS_MODULE->name);
-        ret = -1;
-        goto class_create_failed;
-    }
-    printk(KERN_INFO "%s : class_create() successfull\n",THIS_MODULE->name);
-    
-    for(i=0; i<devcnt; i++)
-    {
-        devno = MKDEV(major, i);
-        pdevice = device_create(pclass,NULL,devno,NULL,"pchar%d",i);
-        if(IS_ERR(pdevice))
+        devices[i]->data = kmalloc(ring_alloc_size(MAX), GFP_KERNEL);
+        if(devices[i]->data == NULL)
         {
-            printk(KERN_ERR "%s : device_create() failed for device %d\n",THIS_MODULE->name,i);
-            ret = -1;
-            goto device_create_failed;
+            kmem_cache_free(pchar_cache, devices[i]);
+            printk(KERN_ERR "%s : ring alloc failed for device %d\n",THIS_MODULE->name,i);
+            goto ring_alloc_failed;
         }
+        devices[i]->mask = MAX - 1;
+        devices[i]->node = page_to_nid(virt_to_page(devices[i]->data));
+        devices[i]->stats = kcalloc(nr_node_ids, sizeof(struct pchar_node_stats), GFP_KERNEL);
+        if(devices[i]->stats == NULL)
+        {
+            kfree(devices[i]->data);
+            kmem_cache_free(pchar_cache, devices[i]);
+            printk(KERN_ERR "%s : node stats alloc failed for device %d\n",THIS_MODULE->name,i);
+            goto ring_alloc_failed;
+        }
+        // sysfs attributes can run as soon as the device is created below
+        sema_init(&devices[i]->sem, 1);
+        mutex_init(&devices[i]->lock);
+        mutex_init(&devices[i]->rd_lock);
+        init_waitqueue_head(&devices[i]->rd_wq);
+        devices[i]->fwd = NULL;
+        RCU_INIT_POINTER(devices[i]->filter, NULL);
     }
-    printk(KERN_INFO "%s : device_create() successfull\n",THIS_MODULE->name);
+    printk(KERN_INFO "%s : ring alloc successfully created %d devices\n",THIS_MODULE->name,devcnt);
 
+    // one extra minor for pchar_any, see core/pchar_reg.h
+    ret = pchar_reg_init(&reg, devcnt + 1);
+    if(ret != 0)
+        goto reg_init_failed;
     for(i=0; i<devcnt; i++)
     {
-        devno = MKDEV(major, i);
-        devices[i].devno = devno;
-        cdev_init(&devices[i].cdev,&pchar_fops);
-        ret = cdev_add(&devices[i].cdev,devno,1);
+        devices[i]->devno = MKDEV(MAJOR(reg.devno), i);
+        ret = pchar_reg_add(&reg, i, &devices[i]->cdev, &pchar_fops, pchar_groups, devices[i], "pchar%d", i);
         if(ret != 0)
-        {
-            printk(KERN_ERR "%s : cdev_add() failed\n",THIS_MODULE->name);
-            goto cdev_add_failed;
-        }
+            goto reg_add_failed;
     }
-    printk(KERN_INFO "%s : cdev_add() successfull\n",THIS_MODULE->name);
-
-    for(i=0; i<devcnt; i++)
-        sema_init(&devices[i].sem, 1);
-    printk(KERN_INFO "%s : sema_init() for all devices\n",THIS_MODULE->name);
+    ret = pchar_reg_add(&reg, devcnt, &any_cdev, &pchar_any_fops, NULL, NULL, "pchar_any");
+    if(ret != 0)
+        goto reg_add_failed;
 
     printk(KERN_INFO "%s : init_mod() completed\n",THIS_MODULE->name);
     return 0;
 
-cdev_add_failed:
-    for(i=i-1; i>=0; i--)
-        cdev_del(&devices[i].cdev);
-    i = devcnt;
-device_create_failed:
-    for(i=i-1; i>=0; i--) 
-    {
-        devno = MKDEV(major, i);
-        device_destroy(pclass, devno);
-    }
-    class_destroy(pclass);
-class_create_failed:
-    unregister_chrdev_region(devno,devcnt);
-alloc_chrdev_region_failed:
+reg_add_failed:
+    pchar_reg_exit(&reg);
+reg_init_failed:
     i=devcnt;
-kfifo_alloc_failed:
+ring_alloc_failed:
     for(i=i-1; i>=0; i--)
-        kfifo_free(&devices[i].buf);
+    {
+        kfree(devices[i]->stats);
+        kfree(devices[i]->data);
+        kmem_cache_free(pchar_cache, devices[i]);
+    }
     kfree(devices);
 devices_kmalloc_failed:
+    kmem_cache_destroy(pchar_cache);
+cache_create_failed:
     return ret;
 
 }
@@ -144,32 +344,28 @@ devices_kmalloc_failed:
 static __exit void exit_pchar(void)
 {
     int i;
-    dev_t devno;
 
     printk(KERN_INFO "%s : exit_mod() called\n",THIS_MODULE->name);
 
-    for(i=devcnt-1; i>=0; i--)
-        cdev_del(&devices[i].cdev);
-    printk(KERN_INFO "%s : cdev_del() device removed\n",THIS_MODULE->name);
+    pchar_reg_exit(&reg);
 
-    for(i=devcnt-1; i>=0; i--) 
+    for(i=devcnt-1; i>=0; i--)
     {
-        devno = MKDEV(major, i);
-        device_destroy(pclass, devno);
+        if(rcu_access_pointer(devices[i]->filter) != NULL)
+            bpf_prog_put(rcu_dereference_protected(devices[i]->filter, 1));
     }
-    printk(KERN_INFO "%s : device_destroy() device removed\n",THIS_MODULE->name);
-
-    class_destroy(pclass);
-    printk(KERN_INFO "%s : class_destroy() destroyed device class\n",THIS_MODULE->name);
-
-    unregister_chrdev_region(devno,devcnt);
-    printk(KERN_INFO "%s : unregister_chrdev_region() release device number\n",THIS_MODULE->name);
+    printk(KERN_INFO "%s: bpf_prog_put() released filters.\n", THIS_MODULE->name);
 
    for(i=devcnt-1; i>=0; i--)
-        kfifo_free(&devices[i].buf);
-    printk(KERN_INFO "%s: kfifo_free() destroyed devices.\n", THIS_MODULE->name);
+    {
+        kfree(devices[i]->stats);
+        kfree(devices[i]->data);
+        kmem_cache_free(pchar_cache, devices[i]);
+    }
+    printk(KERN_INFO "%s: kmem_cache_free() destroyed devices.\n", THIS_MODULE->name);
     
     kfree(devices);
+    kmem_cache_destroy(pchar_cache);
     printk(KERN_INFO "%s: kfree() released devices private struct memory.\n", THIS_MODULE->name);
     
     printk(KERN_INFO "%s : exit_mod() completed\n",THIS_MODULE->name);
@@ -187,12 +383,59 @@ static int pchar_open(struct inode *pinode, struct file *pfile)
     return 0;
 }
 
+// least backlogged channel that is free right now, returned with its semaphore held
+static struct pchar_device *pchar_pick(void)
+{
+    unsigned long tried = 0;
+    int i, n, best;
+
+    for(n=0; n<devcnt; n++)
+    {
+        best = -1;
+        for(i=0; i<devcnt; i++)
+            if(!(tried & BIT(i)) && (best < 0 || ring_len(devices[i]) < ring_len(devices[best])))
+                best = i;
+        tried |= BIT(best);
+        if(down_trylock(&devices[best]->sem) == 0)
+            return devices[best];
+    }
+    return NULL;
+}
+
+// pchar_any: bind the file to a free channel instead of queueing on a busy one
+static int pchar_any_open(struct inode *pinode, struct file *pfile)
+{
+    struct pchar_device *pdev;
+    int ret;
+
+    printk(KERN_INFO "%s : pchar_any_open() called\n",THIS_MODULE->name);
+    pdev = pchar_pick();
+    if(pdev == NULL)
+    {
+        if(pfile->f_flags & O_NONBLOCK)
+            return -EBUSY;
+        ret = wait_event_interruptible(any_wq, (pdev = pchar_pick()) != NULL);
+        if(ret != 0)
+        {
+            printk(KERN_INFO "%s : pchar_any_open() wake-up due to signal\n",THIS_MODULE->name);
+            return -ERESTARTSYS;
+        }
+    }
+    pfile->private_data = pdev;
+    // from now on the file behaves exactly as if pchar<minor> was opened
+    replace_fops(pfile, fops_get(&pchar_fops));
+    printk(KERN_INFO "%s: pchar_any bound process %d (%s) to pchar%d.\n", THIS_MODULE->name, get_current()->pid, get_current()->comm, MINOR(pdev->devno));
+
+    return 0;
+}
+
 static int pchar_close(struct inode *pinode, struct file *pfile)
 {
     printk(KERN_INFO "%s : pchar_close() called\n",THIS_MODULE->name);
     struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
     
     up(&pdev->sem);
+    wake_up_interruptible(&any_wq);
     printk(KERN_INFO "%s: device pchar%d unlock is acquired by process %d (%s).\n", THIS_MODULE->name, MINOR(pdev->devno), get_current()->pid, get_current()->comm);
 
     return 0;
@@ -204,7 +447,16 @@ static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *p
 
     printk(KERN_INFO "%s : pchar_read() called\n",THIS_MODULE->name);
     struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
-    ret = kfifo_to_user(&pdev->buf, ubuf, size, &nbytes);
+
+    // first reader after load, or after numa_node was set to -1, pulls the ring to its node
+    if(!READ_ONCE(pdev->placed))
+        pchar_migrate(pdev, numa_node_id());
+
+    mutex_lock(&pdev->rd_lock);
+    ret = ring_to_user(pdev, ubuf, size, &nbytes);
+    if(ret == 0)
+        pdev->stats[numa_node_id()].rd_bytes += nbytes;
+    mutex_unlock(&pdev->rd_lock);
     if(ret < 0)
     {
         printk(KERN_ERR "%s : pchar_read() failed\n",THIS_MODULE->name);
@@ -212,6 +464,90 @@ static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *p
     }
     printk(KERN_INFO "%s : pchar_read() copied %d bytes to user space\n",THIS_MODULE->name,nbytes);
 
+    // room for writers polling for EPOLLOUT
+    if(nbytes > 0)
+        wake_up_interruptible(&pdev->rd_wq);
+
+    return nbytes;
+}
+
+// new data on pdev: wake its readers and any gather read waiting on it
+static void pchar_wake(struct pchar_device *pdev)
+{
+    wake_up_interruptible(&pdev->rd_wq);
+    wake_up_interruptible(&gather_wq);
+}
+
+// last stage of the pipeline pdev belongs to
+static struct pchar_device *pchar_target(struct pchar_device *pdev)
+{
+    mutex_lock(&link_lock);
+    while(pdev->fwd != NULL)
+        pdev = pdev->fwd;
+    mutex_unlock(&link_lock);
+    return pdev;
+}
+
+// filtered write: the record is copied once into an skb, classified, then queued from kernel memory.
+// a record is classified as a whole, so it is queued whole or not at all.
+static ssize_t pchar_write_filtered(struct pchar_device *pdev, const char *ubuf, size_t size)
+{
+    struct sk_buff *skb;
+    struct bpf_prog *prog;
+    u32 verdict;
+    int nbytes;
+
+    // every ring has the same size, a record that does not fit this one fits no target
+    if(size > ring_size(pdev))
+    {
+        printk(KERN_ERR "%s : pchar_write() record of %zu bytes is larger than the ring\n",THIS_MODULE->name,size);
+        return -EMSGSIZE;
+    }
+    skb = alloc_skb(size, GFP_KERNEL);
+    if(skb == NULL)
+    {
+        printk(KERN_ERR "%s : pchar_write() alloc_skb failed\n",THIS_MODULE->name);
+        return -ENOMEM;
+    }
+    if(copy_from_user(skb_put(skb, size), ubuf, size))
+    {
+        kfree_skb(skb);
+        printk(KERN_ERR "%s : pchar_write() failed\n",THIS_MODULE->name);
+        return -EFAULT;
+    }
+
+    rcu_read_lock();
+    prog = rcu_dereference(pdev->filter);
+    verdict = prog != NULL ? bpf_prog_run_pin_on_cpu(prog, skb) : FILTER_ACCEPT;
+    rcu_read_unlock();
+
+    if(verdict == FILTER_DROP)
+    {
+        consume_skb(skb);
+        printk(KERN_INFO "%s : pchar_write() filter dropped %zu bytes\n",THIS_MODULE->name,size);
+        return size;
+    }
+    if((verdict & FILTER_STEER_FLAG) && (verdict & ~FILTER_STEER_FLAG) < devcnt)
+        pdev = devices[verdict & ~FILTER_STEER_FLAG];
+
+    pdev = pchar_target(pdev);
+    mutex_lock(&pdev->lock);
+    // readers only add room, a record that fits now still fits in ring_in()
+    if(ring_avail(pdev) < skb->len)
+    {
+        mutex_unlock(&pdev->lock);
+        consume_skb(skb);
+        return -EAGAIN;
+    }
+    nbytes = ring_in(pdev, skb->data, skb->len);
+    pdev->stats[numa_node_id()].wr_bytes += nbytes;
+    mutex_unlock(&pdev->lock);
+    consume_skb(skb);
+    printk(KERN_INFO "%s : pchar_write() filter queued %d bytes on pchar%d\n",THIS_MODULE->name,nbytes,MINOR(pdev->devno));
+
+    if(nbytes > 0)
+        pchar_wake(pdev);
+
     return nbytes;
 }
 
@@ -222,17 +558,235 @@ static ssize_t pchar_write(struct file *pfile, const char *ubuf, size_t size, lo
     printk(KERN_INFO "%s : pchar_write() called\n",THIS_MODULE->name);
     printk(KERN_INFO "%s: pchar_write() called.\n", THIS_MODULE->name);
     struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
-    ret = kfifo_from_user(&pdev->buf, ubuf, size, &nbytes);
+
+    if(rcu_access_pointer(pdev->filter) != NULL)
+        return pchar_write_filtered(pdev, ubuf, size);
+
+    // linked device: data goes straight into the last stage of the pipeline
+    pdev = pchar_target(pdev);
+
+    mutex_lock(&pdev->lock);
+    ret = ring_from_user(pdev, ubuf, size, &nbytes);
+    if(ret == 0)
+        pdev->stats[numa_node_id()].wr_bytes += nbytes;
+    mutex_unlock(&pdev->lock);
     if(ret < 0)
     {
         printk(KERN_ERR "%s : pchar_write() failed\n",THIS_MODULE->name);
         return ret;
     }
-    printk(KERN_INFO "%s : pchar_write() copied %d bytes from user space\n",THIS_MODULE->name,nbytes);
+    printk(KERN_INFO "%s : pchar_write() copied %d bytes from user space to pchar%d\n",THIS_MODULE->name,nbytes,MINOR(pdev->devno));
+
+    if(nbytes > 0)
+        pchar_wake(pdev);
 
     return nbytes;
 }
 
+// readable from this device, writable when the ring writes end up in has room
+static __poll_t pchar_poll(struct file *pfile, poll_table *wait)
+{
+    struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
+    struct pchar_device *dst = pchar_target(pdev);
+    __poll_t mask = 0;
+
+    poll_wait(pfile, &pdev->rd_wq, wait);
+    if(dst != pdev)
+        poll_wait(pfile, &dst->rd_wq, wait);
+    if(!ring_is_empty(pdev))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if(!ring_is_full(dst))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+}
+
+// move bytes already buffered in src to dst, src is drained by its only reader (the caller)
+static void pchar_flush(struct pchar_device *src, struct pchar_device *dst)
+{
+    char kbuf[MAX];
+    unsigned int len;
+
+    mutex_lock(&src->rd_lock);
+    mutex_lock(&dst->lock);
+    while(!ring_is_empty(src) && !ring_is_full(dst))
+    {
+        len = min(ring_avail(dst), (unsigned int)sizeof(kbuf));
+        len = ring_out(src, kbuf, len);
+        ring_in(dst, kbuf, len);
+    }
+    mutex_unlock(&dst->lock);
+    mutex_unlock(&src->rd_lock);
+    pchar_wake(dst);
+}
+
+static int pchar_link(struct pchar_device *pdev, int minor)
+{
+    struct pchar_device *dst, *p;
+
+    if(minor < 0)
+    {
+        mutex_lock(&link_lock);
+        pdev->fwd = NULL;
+        mutex_unlock(&link_lock);
+        printk(KERN_INFO "%s: pchar%d unlinked\n",THIS_MODULE->name,MINOR(pdev->devno));
+        return 0;
+    }
+    if(minor >= devcnt)
+        return -ENODEV;
+
+    dst = devices[minor];
+    mutex_lock(&link_lock);
+    // refuse links that would make the pipeline a loop
+    for(p = dst; p != NULL; p = p->fwd)
+    {
+        if(p == pdev)
+        {
+            mutex_unlock(&link_lock);
+            printk(KERN_ERR "%s: pchar%d -> pchar%d would loop\n",THIS_MODULE->name,MINOR(pdev->devno),minor);
+            return -ELOOP;
+        }
+    }
+    pdev->fwd = dst;
+    while(dst->fwd != NULL)
+        dst = dst->fwd;
+    mutex_unlock(&link_lock);
+
+    pchar_flush(pdev, dst);
+    printk(KERN_INFO "%s: pchar%d linked to pchar%d\n",THIS_MODULE->name,MINOR(pdev->devno),minor);
+    return 0;
+}
+
+// attach a BPF_PROG_TYPE_SOCKET_FILTER program by fd, fd < 0 detaches
+static int pchar_attach_filter(struct pchar_device *pdev, int fd)
+{
+    struct bpf_prog *prog = NULL, *old;
+
+    if(fd >= 0)
+    {
+        prog = bpf_prog_get_type(fd, BPF_PROG_TYPE_SOCKET_FILTER);
+        if(IS_ERR(prog))
+        {
+            printk(KERN_ERR "%s: pchar%d bpf_prog_get_type() failed\n",THIS_MODULE->name,MINOR(pdev->devno));
+            return PTR_ERR(prog);
+        }
+    }
+
+    mutex_lock(&pdev->lock);
+    old = rcu_dereference_protected(pdev->filter, lockdep_is_held(&pdev->lock));
+    rcu_assign_pointer(pdev->filter, prog);
+    mutex_unlock(&pdev->lock);
+
+    // bpf_prog_put() frees the program only after an rcu grace period
+    if(old != NULL)
+        bpf_prog_put(old);
+    printk(KERN_INFO "%s: pchar%d filter %s\n",THIS_MODULE->name,MINOR(pdev->devno),prog ? "attached" : "detached");
+    return 0;
+}
+
+static int pchar_any_ready(gather_t *g)
+{
+    int i;
+
+    for(i=0; i<g->count; i++)
+        if(!ring_is_empty(devices[g->minors[i]]))
+            return 1;
+    return 0;
+}
+
+// drain the listed devices back to back into one user buffer, returns the bytes copied.
+// data taken from earlier devices is already gone from their rings, so a failure part way
+// still reports it: lens and the total so far, the error only when nothing was copied.
+static long pchar_gather(gather_t *ug)
+{
+    gather_t g;
+    struct pchar_device *pdev;
+    unsigned int off = 0;
+    int i, ret = 0, nbytes;
+
+    if(copy_from_user(&g, ug, sizeof(gather_t)))
+        return -EFAULT;
+    if(g.count <= 0 || g.count > GATHER_MAX || g.size < 0)
+        return -EINVAL;
+    for(i=0; i<g.count; i++)
+        if(g.minors[i] < 0 || g.minors[i] >= devcnt)
+            return -ENODEV;
+
+    if(g.block)
+    {
+        ret = wait_event_interruptible(gather_wq, pchar_any_ready(&g));
+        if(ret != 0)
+        {
+            printk(KERN_INFO "%s : pchar_gather() wake-up due to signal\n",THIS_MODULE->name);
+            return -ERESTARTSYS;
+        }
+    }
+
+    for(i=0; i<g.count; i++)
+    {
+        pdev = devices[g.minors[i]];
+        mutex_lock(&pdev->rd_lock);
+        ret = ring_to_user(pdev, g.buf + off, g.size - off, &nbytes);
+        if(ret == 0)
+            pdev->stats[numa_node_id()].rd_bytes += nbytes;
+        mutex_unlock(&pdev->rd_lock);
+        if(ret < 0)
+        {
+            printk(KERN_ERR "%s : pchar_gather() failed on pchar%d\n",THIS_MODULE->name,g.minors[i]);
+            break;
+        }
+        g.lens[i] = nbytes;
+        off += nbytes;
+        if(nbytes > 0)
+            wake_up_interruptible(&pdev->rd_wq);
+    }
+    for(; i<g.count; i++)
+        g.lens[i] = 0;
+    printk(KERN_INFO "%s : pchar_gather() copied %u bytes from %d devices\n",THIS_MODULE->name,off,g.count);
+
+    if(off == 0 && ret < 0)
+        return ret;
+    if(copy_to_user(ug->lens, g.lens, sizeof(g.lens)))
+        return -EFAULT;
+    return off;
+}
+
+static long pchar_ioctl(struct file *pfile, unsigned int cmd, unsigned long param)
+{
+    struct pchar_device *pdev = (struct pchar_device *)pfile->private_data;
+    int minor, fd;
+
+    switch(cmd)
+    {
+        case FIFO_GET_MINOR:
+            minor = MINOR(pdev->devno);
+            if(copy_to_user((void*)param, &minor, sizeof(minor)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() fifo get minor\n",THIS_MODULE->name);
+            return 0;
+
+        case FIFO_LINK:
+            if(copy_from_user(&minor, (void*)param, sizeof(minor)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() fifo link\n",THIS_MODULE->name);
+            return pchar_link(pdev, minor);
+
+        case FIFO_ATTACH_FILTER:
+            if(copy_from_user(&fd, (void*)param, sizeof(fd)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() fifo attach filter\n",THIS_MODULE->name);
+            return pchar_attach_filter(pdev, fd);
+
+        case FIFO_GATHER:
+            printk(KERN_INFO "%s: ioctl() fifo gather\n",THIS_MODULE->name);
+            return pchar_gather((gather_t *)param);
+
+        default:
+            printk(KERN_INFO "%s: ioctl() unsupported cmd\n",THIS_MODULE->name);
+            return -EINVAL;
+    }
+    return 0;
+}
+
 module_init(init_pchar);
 module_exit(exit_pchar);
 
@@ -0,0 +1,30 @@
+#ifndef __SEMA_H
+#define __SEMA_H
+
+#include "linux/ioctl.h"
+
+#define GATHER_MAX 8
+
+typedef struct{
+	int count;//number of minors listed
+	int minors[GATHER_MAX];//devices to drain, in order
+	int lens[GATHER_MAX];//out: bytes copied from each device
+	int size;//size of buf
+	int block;//1 = sleep until any listed device has data
+	char *buf;//destination, device data is placed back to back
+}gather_t;
+
+#define FIFO_LINK _IOW('x',9,int)//forward writes to pchar<minor> inside the kernel, -1 = unlink
+#define FIFO_ATTACH_FILTER _IOW('x',10,int)//socket filter bpf prog fd run on each write, -1 = detach
+//with a filter attached each write is one record: queued whole, or -EAGAIN when the target is
+//short of room, -EMSGSIZE when larger than a ring
+#define FIFO_GATHER _IOWR('x',11,gather_t)//drain several devices in one call, returns bytes copied
+#define FIFO_GET_MINOR _IOR('x',20,int)//channel the file is bound to, e.g. after opening pchar_any
+
+//filter program return values
+#define FILTER_DROP 0//discard the record
+#define FILTER_ACCEPT 1//queue on this device, as does any other non-steer value
+#define FILTER_STEER_FLAG 0x80000000u
+#define FILTER_STEER(minor) (FILTER_STEER_FLAG | (minor))//queue on pchar<minor>
+
+#endif
@@ -1,28 +1,35 @@
 #include <linux/module.h>
-#include <linux/timer.h>
 #include <linux/io.h>
+#include "periodic.h"
 
-struct timer_list mytimer;
-int ticks;
+static unsigned int disable_us = 10000000;
+module_param(disable_us, uint, 0444);
+MODULE_PARM_DESC(disable_us, "time the keyboard stays disabled in us");
+
+struct periodic_task mytask;
 //int count = 0;
 
-void mytimer_function(struct timer_list *ptimer)
+//runs once: returning false does not re-arm
+bool mytimer_function(struct periodic_task *ptask)
 {	
 	//count++;
-	//mod_timer(&mytimer, jiffies + ticks);
 	outb(0xAE, 0x64);
 	printk(KERN_INFO "%s kybd enabled\n",THIS_MODULE->name);
+	return false;
 }
 
 static __init int desd_init(void)
 {
-	int sec = 10;
-	ticks = sec * HZ;		//750
-	printk(KERN_INFO "%s kybd disable for %d second\n",THIS_MODULE->name,sec);
+	int ret;
+
+	printk(KERN_INFO "%s kybd disable for %u us\n",THIS_MODULE->name,disable_us);
 	outb(0xAD, 0x64);
-	timer_setup(&mytimer, mytimer_function, 0);
-	mytimer.expires = jiffies + ticks;
-	add_timer(&mytimer);
+	ret = periodic_add(&mytask, (u64)disable_us * NSEC_PER_USEC, mytimer_function);
+	if(ret != 0)
+	{
+		outb(0xAE, 0x64);
+		return ret;
+	}
 
 	printk(KERN_INFO " %s : Timer initialisation is done successfully\n", THIS_MODULE->name);
 	
@@ -31,7 +38,7 @@ static __init int desd_init(void)
 
 static __exit void desd_exit(void)
 {
-	del_timer_sync(&mytimer);
+	periodic_del(&mytask);
 	printk(KERN_INFO " %s : Timer deinitialisation is done successfully\n", THIS_MODULE->name);
 }
 module_init(desd_init);
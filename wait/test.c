@@ -0,0 +1,161 @@
+#include<stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "wait.h"
+
+static void usage(const char *name)
+{
+	printf("invalid usage\n");
+	printf("usage1: %s read <timeout_ms>\n",name);
+	printf("usage2: %s write <timeout_ms> <data>\n",name);
+	printf("usage3: %s deadline <ms_from_now>\n",name);
+	printf("usage4: %s overwrite <0|1>\n",name);
+	printf("usage5: %s dropped\n",name);
+	printf("usage6: %s sendat <ms_from_now> <data>\n",name);
+	printf("usage7: %s compress <0|1>\n",name);
+	printf("usage8: %s compstats\n",name);
+	printf("usage9: %s atomic <threshold> <data>\n",name);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd,ret;
+	char buf[64];
+	timeout_t timeout = { -1, -1 };
+
+	if(argc<2)
+	{
+		usage(argv[0]);
+		_exit(2);
+	}
+
+	fd = open("/dev/pchar0", O_RDWR);
+	if(fd<0)
+	{
+		perror("open() failed");
+		_exit(1);
+	}
+
+	if(strcmp(argv[1],"read") == 0 && argc==3)
+	{
+		timeout.rd_timeout_ms = atoi(argv[2]);
+		ret = ioctl(fd, FIFO_SET_TIMEOUT, &timeout);
+		if(ret != 0)
+			perror("ioctl() failed");
+		ret = read(fd, buf, sizeof(buf)-1);
+		if(ret < 0)
+			printf("read() failed: %s\n", errno == ETIMEDOUT ? "timed out" : strerror(errno));
+		else
+		{
+			buf[ret] = '\0';
+			printf("read %d bytes: %s\n",ret,buf);
+		}
+	}
+	else if(strcmp(argv[1],"write")==0 && argc==4)
+	{
+		timeout.wr_timeout_ms = atoi(argv[2]);
+		ret = ioctl(fd, FIFO_SET_TIMEOUT, &timeout);
+		if(ret != 0)
+			perror("ioctl() failed");
+		ret = write(fd, argv[3], strlen(argv[3]));
+		if(ret < 0)
+			printf("write() failed: %s\n", errno == ETIMEDOUT ? "timed out" : strerror(errno));
+		else
+			printf("wrote %d bytes\n",ret);
+	}
+	else if(strcmp(argv[1],"deadline")==0 && argc==3)
+	{
+		struct timespec now;
+		long long deadline;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		deadline = now.tv_sec*1000000000LL + now.tv_nsec + atoll(argv[2])*1000000LL;
+		ret = ioctl(fd, FIFO_SET_DEADLINE, &deadline);
+		if(ret != 0)
+			perror("ioctl() failed");
+		ret = read(fd, buf, sizeof(buf)-1);
+		if(ret < 0)
+			printf("read() failed: %s\n", errno == ETIMEDOUT ? "deadline expired" : strerror(errno));
+		else
+			printf("read %d bytes before deadline\n",ret);
+	}
+	else if(strcmp(argv[1],"overwrite")==0 && argc==3)
+	{
+		int mode = atoi(argv[2]);
+
+		ret = ioctl(fd, FIFO_SET_OVERWRITE, &mode);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("overwrite mode %s\n", mode ? "on" : "off");
+	}
+	else if(strcmp(argv[1],"dropped")==0)
+	{
+		unsigned long long dropped;
+
+		ret = ioctl(fd, FIFO_GET_DROPPED, &dropped);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("dropped bytes : %llu\n",dropped);
+	}
+	else if(strcmp(argv[1],"sendat")==0 && argc==4)
+	{
+		struct timespec now;
+		delayed_t msg;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		msg.release_ns = now.tv_sec*1000000000LL + now.tv_nsec + atoll(argv[2])*1000000LL;
+		msg.len = strlen(argv[3]) < DELAY_MAX ? strlen(argv[3]) : DELAY_MAX;
+		memcpy(msg.data, argv[3], msg.len);
+		ret = ioctl(fd, FIFO_SEND_AT, &msg);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("%d bytes scheduled in %s ms\n",msg.len,argv[2]);
+	}
+	else if(strcmp(argv[1],"compress")==0 && argc==3)
+	{
+		int mode = atoi(argv[2]);
+
+		ret = ioctl(fd, FIFO_SET_COMPRESS, &mode);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("compress mode %s\n", mode ? "on" : "off");
+	}
+	else if(strcmp(argv[1],"compstats")==0)
+	{
+		comp_t comp;
+
+		ret = ioctl(fd, FIFO_GET_COMP_STATS, &comp);
+		if(ret != 0)
+			perror("ioctl() failed");
+		else
+			printf("compress stats : raw=%llu, stored=%llu, ratio=%.2f\n",comp.raw_bytes,comp.stored_bytes,
+				comp.stored_bytes ? (double)comp.raw_bytes/comp.stored_bytes : 0.0);
+	}
+	else if(strcmp(argv[1],"atomic")==0 && argc==4)
+	{
+		int threshold = atoi(argv[2]);
+
+		ret = ioctl(fd, FIFO_SET_ATOMIC, &threshold);
+		if(ret != 0)
+			perror("ioctl() failed");
+		ret = write(fd, argv[3], strlen(argv[3]));
+		if(ret < 0)
+			perror("write() failed");
+		else
+			printf("wrote %d of %zu bytes\n",ret,strlen(argv[3]));
+	}
+	else
+		usage(argv[0]);
+
+	close(fd);
+	return 0;
+}
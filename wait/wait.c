@@ -4,37 +4,105 @@
 #include <linux/cdev.h>
 #include <linux/kfifo.h>
 #include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>
+#include <linux/crypto.h>
+#include "wait.h"
+#include "pchar_reg.h"
 
 static int pchar_open(struct inode *, struct file *);
 static int pchar_close(struct inode *, struct file *);
 static ssize_t pchar_read(struct file *, char *, size_t, loff_t *);
 static ssize_t pchar_write(struct file *, const char *, size_t, loff_t *);
+static long pchar_ioctl(struct file *, unsigned int, unsigned long);
 
 #define MAX 32
+#define CHUNK 256//raw bytes compressed together in compress mode
+
+//per open file private structure
+struct pchar_file
+{
+    ktime_t rd_timeout;//KTIME_MAX = wait forever
+    ktime_t wr_timeout;
+    ktime_t deadline;//absolute CLOCK_MONOTONIC, 0 = no deadline
+};
+
 static struct kfifo buf;
-static dev_t devno;
-static int major;
-static struct class *pclass;
+static struct pchar_reg reg;
 static struct cdev cdev;
 static wait_queue_head_t wr_wq;
 static wait_queue_head_t rd_wq;
+static int overwrite;//flight-recorder mode: full fifo evicts oldest bytes instead of blocking
+static unsigned long long dropped;//bytes evicted in overwrite mode
+static DEFINE_MUTEX(fifo_lock);//serializes fifo producers and the reader against eviction
+
+static int atomic_max;//writes up to this size are all-or-nothing, 0 = off
+
+static int fifo_size = MAX;
+module_param(fifo_size, int, 0444);
+MODULE_PARM_DESC(fifo_size, "fifo size in bytes, compress mode needs room for a whole chunk");
+
+//compress mode: the fifo holds lz4 chunks, each led by a chunk_hdr
+struct chunk_hdr
+{
+    u16 clen;//stored bytes, 0 = chunk stored uncompressed
+    u16 rlen;//raw bytes
+};
+
+static int compress;
+static struct crypto_comp *tfm;
+static char *wr_stage;//raw bytes waiting to fill a chunk
+static unsigned int wr_len;
+static char *rd_stage;//decompressed chunk being read
+static unsigned int rd_off, rd_len;
+static char *cbuf;//compressed chunk scratch
+static unsigned long long comp_raw, comp_stored;
+
+//message waiting in the delayed-delivery heap
+struct delayed_msg
+{
+    ktime_t release;//absolute CLOCK_MONOTONIC release time
+    u64 seq;//keeps messages with equal release time in submit order
+    unsigned int len;
+    char data[];
+};
+
+static int max_delayed = 262144;
+module_param(max_delayed, int, 0644);
+MODULE_PARM_DESC(max_delayed, "maximum number of messages pending delayed delivery");
+
+static struct delayed_msg **heap;//min-heap on (release, seq)
+static int heap_cnt, heap_cap;
+static u64 heap_seq;
+static int delay_stalled;//due message did not fit, retried after the next read
+static struct hrtimer delay_timer;//armed for the earliest release time
+static struct work_struct delay_work;
+static DEFINE_MUTEX(delay_lock);//protects the heap
 
 static struct file_operations pchar_fops = {
     .owner = THIS_MODULE,
     .open = pchar_open,
     .release = pchar_close,
     .read = pchar_read,
-    .write = pchar_write
+    .write = pchar_write,
+    .unlocked_ioctl = pchar_ioctl
 };
 
+static enum hrtimer_restart delay_timer_fn(struct hrtimer *);
+static void delay_work_fn(struct work_struct *);
+
 static __init int init_mod(void)
 {
-    int ret, minor;
-    struct device *pdevice;
+    int ret;
 
     printk(KERN_INFO "%s init_mod() called\n",THIS_MODULE->name);
     // 1) fifo
-    ret = kfifo_alloc(&buf,MAX,GFP_KERNEL);
+    ret = kfifo_alloc(&buf,fifo_size,GFP_KERNEL);
     if(ret != 0)
     {
         printk(KERN_ERR "%s kfifo_alloc() failed\n",THIS_MODULE->name);
@@ -42,50 +110,7 @@ static __init int init_mod(void)
     }
     printk(KERN_INFO "%s kfifo_alloc() sucess\n",THIS_MODULE->name);
 
-    //2) mjor minor no / device no
-    //int alloc_chrdev_region(dev_t *dev, unsigned baseminor, unsigned count, const char *name);
-    ret = alloc_chrdev_region(&devno, 0, 1,"pchar");
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s allco_chrdev_region() failed\n",THIS_MODULE->name);
-        goto allco_chrdev_region_failed;
-    }
-    major = MAJOR(devno);
-    minor = MINOR(devno);
-    printk(KERN_INFO "%s allco_chrdev_region() done : devno = %d/%d\n",THIS_MODULE->name,major,minor);
-    ///proc/devices
-    //3) device class
-    //Device class is created under /sys/class 
-    pclass = class_create(THIS_MODULE, "pchar_class");
-    if(IS_ERR(pclass))
-    {
-        printk(KERN_ERR "%s class_create() failed\n",THIS_MODULE->name);
-        ret = -1;
-        goto class_create_failed;    
-    }
-    printk(KERN_INFO "%s class_create() completed\n",THIS_MODULE->name);
-
-    //4) device create
-    //Device file is create under /sys/devices/ virtual/class_name/devname and /dev/devname
-    pdevice = device_create(pclass,NULL,devno,NULL,"pchar%d",0);
-    if(IS_ERR(pdevice))
-    {
-        printk(KERN_ERR "%s device_create() failed\n",THIS_MODULE->name);
-        ret = -1;
-        goto device_create_failed;    
-    }
-    printk(KERN_INFO "%s device_create() completed\n",THIS_MODULE->name);
-
-    //5) cdev add / add device
-    cdev_init(&cdev,&pchar_fops);
-    ret = cdev_add(&cdev,devno,1);
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s cdev_add() failed\n",THIS_MODULE->name);
-        goto cdev_add_failed;
-    }
-    printk(KERN_INFO "%s cdev_add() completed\n",THIS_MODULE->name);
-    
+    // wait queues and the delay timer first, read() and write() can run once the cdev is added
     // write waiting queue init
     init_waitqueue_head(&wr_wq);
     printk(KERN_INFO "%s: init_waitqueue_head() write wait queue\n",THIS_MODULE->name);
@@ -93,18 +118,28 @@ static __init int init_mod(void)
     // read waiting queue init
     init_waitqueue_head(&rd_wq);
     printk(KERN_INFO "%s: init_waitqueue_head() read wait queue\n",THIS_MODULE->name);
+
+    // delayed delivery timer and work
+    INIT_WORK(&delay_work, delay_work_fn);
+    hrtimer_init(&delay_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    delay_timer.function = delay_timer_fn;
+    printk(KERN_INFO "%s: hrtimer_init() delayed delivery timer\n",THIS_MODULE->name);
+    
+    //2) device number, class, /dev/pchar0 and its cdev, see core/pchar_reg.h
+    ret = pchar_reg_init(&reg, 1);
+    if(ret != 0)
+        goto reg_init_failed;
+    ret = pchar_reg_add(&reg, 0, &cdev, &pchar_fops, NULL, NULL, "pchar%d", 0);
+    if(ret != 0)
+        goto reg_add_failed;
     
     printk(KERN_INFO "%s init_mod() completed\n",THIS_MODULE->name);
     
     return 0;
 
-cdev_add_failed:
-    device_destroy(pclass,devno);
-device_create_failed:    
-    class_destroy(pclass);
-class_create_failed:
-    unregister_chrdev_region(devno,1);
-allco_chrdev_region_failed:
+reg_add_failed:
+    pchar_reg_exit(&reg);
+reg_init_failed:
     kfifo_free(&buf);
 kfifo_alloc_failed:
     return ret;
@@ -114,17 +149,23 @@ static __exit void exit_mod(void)
 {
     printk(KERN_INFO "%s exit_mod() called\n",THIS_MODULE->name);
 
-    cdev_del(&cdev);
-    printk(KERN_INFO "%s cdev_del() done\n",THIS_MODULE->name);
-
-    device_destroy(pclass,devno);
-    printk(KERN_INFO "%s device_destroy() done\n",THIS_MODULE->name);
+    pchar_reg_exit(&reg);
 
-    class_destroy(pclass);
-    printk(KERN_INFO "%s class_destroy() done\n",THIS_MODULE->name);
+    // the work may re-arm the timer, so cancel the timer again after it
+    hrtimer_cancel(&delay_timer);
+    cancel_work_sync(&delay_work);
+    hrtimer_cancel(&delay_timer);
+    while(heap_cnt > 0)
+        kfree(heap[--heap_cnt]);
+    kvfree(heap);
+    printk(KERN_INFO "%s delayed messages released\n",THIS_MODULE->name);
 
-    unregister_chrdev_region(devno,1);
-    printk(KERN_INFO "%s unregister_chrdev_region() done\n",THIS_MODULE->name);
+    if(tfm != NULL)
+        crypto_free_comp(tfm);
+    kfree(wr_stage);
+    kfree(rd_stage);
+    kfree(cbuf);
+    printk(KERN_INFO "%s compressor released\n",THIS_MODULE->name);
 
     kfifo_free(&buf);
     printk(KERN_INFO "%s kfifo_free() released\n",THIS_MODULE->name);
@@ -134,8 +175,20 @@ static __exit void exit_mod(void)
 
 static int pchar_open(struct inode *pinode, struct file *pfile)
 {
+    struct pchar_file *pf;
     printk(KERN_INFO "%s pchar_open()\n",THIS_MODULE->name);
 
+    pf = kmalloc(sizeof(struct pchar_file), GFP_KERNEL);
+    if(pf == NULL)
+    {
+        printk(KERN_ERR "%s pchar_open() kmalloc failed\n",THIS_MODULE->name);
+        return -ENOMEM;
+    }
+    pf->rd_timeout = KTIME_MAX;
+    pf->wr_timeout = KTIME_MAX;
+    pf->deadline = 0;
+    pfile->private_data = pf;
+
     return 0;
 }
 
@@ -143,16 +196,202 @@ static int pchar_close(struct inode *pinode, struct file *pfile)
 {
     printk(KERN_INFO "%s pchar_close()\n",THIS_MODULE->name);
 
+    kfree(pfile->private_data);
     return 0;
 }
 
+// time left to wait: the shorter of the per-file timeout and what remains till the deadline
+static ktime_t pchar_budget(struct pchar_file *pf, ktime_t timeout)
+{
+    ktime_t left;
+
+    if(pf->deadline == 0)
+        return timeout;
+    left = ktime_sub(pf->deadline, ktime_get());
+    if(left < 0)
+        left = 0;
+    return min(timeout, left);
+}
+
+// raw bytes compress mode can take now: rest of the stage, plus a chunk if the fifo can hold one
+static unsigned int comp_room(void)
+{
+    unsigned int room = CHUNK - wr_len;
+
+    if(kfifo_avail(&buf) >= sizeof(struct chunk_hdr) + CHUNK)
+        room += CHUNK;
+    return room;
+}
+
+static int pchar_readable(void)
+{
+    return !kfifo_is_empty(&buf) || (compress && (rd_off < rd_len || wr_len > 0));
+}
+
+// room for need bytes, need is the whole write when it must land atomically
+static int pchar_writable(unsigned int need)
+{
+    return overwrite || (compress ? comp_room() >= need : kfifo_avail(&buf) >= need);
+}
+
+// compress the staged chunk into the fifo, fifo_lock held
+static int comp_flush(void)
+{
+    struct chunk_hdr hdr;
+    unsigned int clen = CHUNK;
+    char *data = cbuf;
+    int ret;
+
+    ret = crypto_comp_compress(tfm, wr_stage, wr_len, cbuf, &clen);
+    // incompressible data is stored as is
+    if(ret != 0 || clen >= wr_len)
+    {
+        clen = 0;
+        data = wr_stage;
+    }
+    hdr.clen = clen;
+    hdr.rlen = wr_len;
+    if(kfifo_avail(&buf) < sizeof(hdr) + (clen ? clen : wr_len))
+        return -ENOSPC;
+    kfifo_in(&buf, &hdr, sizeof(hdr));
+    kfifo_in(&buf, data, clen ? clen : wr_len);
+    comp_raw += wr_len;
+    comp_stored += sizeof(hdr) + (clen ? clen : wr_len);
+    wr_len = 0;
+    return 0;
+}
+
+// compress mode producer, fifo_lock held: returns raw bytes accepted
+static unsigned int comp_in(const char *kbuf, unsigned int len)
+{
+    unsigned int n = 0, take;
+
+    while(n < len)
+    {
+        if(wr_len == CHUNK && comp_flush() != 0)
+            break;
+        take = min(len - n, CHUNK - wr_len);
+        memcpy(wr_stage + wr_len, kbuf + n, take);
+        wr_len += take;
+        n += take;
+    }
+    // a full stage goes into the fifo right away
+    if(wr_len == CHUNK)
+        comp_flush();
+    return n;
+}
+
+// compress mode consumer, fifo_lock held
+static int comp_out(char *ubuf, size_t size, int *copied)
+{
+    struct chunk_hdr hdr;
+    unsigned int n, dlen;
+
+    *copied = 0;
+    while(*copied < size)
+    {
+        if(rd_off == rd_len)
+        {
+            rd_off = rd_len = 0;
+            if(!kfifo_is_empty(&buf))
+            {
+                if(kfifo_out(&buf, &hdr, sizeof(hdr)) != sizeof(hdr))
+                    return -EIO;
+                if(hdr.clen == 0)
+                {
+                    if(kfifo_out(&buf, rd_stage, hdr.rlen) != hdr.rlen)
+                        return -EIO;
+                }
+                else
+                {
+                    if(kfifo_out(&buf, cbuf, hdr.clen) != hdr.clen)
+                        return -EIO;
+                    dlen = CHUNK;
+                    if(crypto_comp_decompress(tfm, cbuf, hdr.clen, rd_stage, &dlen) != 0 || dlen != hdr.rlen)
+                    {
+                        printk(KERN_ERR "%s pchar_read() lz4 decompress failed\n",THIS_MODULE->name);
+                        return -EIO;
+                    }
+                }
+                rd_len = hdr.rlen;
+            }
+            else if(wr_len > 0)
+            {
+                // nothing compressed yet, hand over the partial chunk
+                memcpy(rd_stage, wr_stage, wr_len);
+                rd_len = wr_len;
+                wr_len = 0;
+            }
+            else
+                break;
+        }
+        n = min_t(size_t, size - *copied, rd_len - rd_off);
+        if(copy_to_user(ubuf + *copied, rd_stage + rd_off, n))
+            return -EFAULT;
+        rd_off += n;
+        *copied += n;
+    }
+    return 0;
+}
+
+static int comp_enable(int on)
+{
+    int ret = 0;
+
+    mutex_lock(&fifo_lock);
+    // chunk format and raw bytes cannot share the fifo
+    if(!kfifo_is_empty(&buf) || wr_len > 0 || rd_off < rd_len || (on && overwrite))
+    {
+        ret = -EBUSY;
+        goto out;
+    }
+    if(on && kfifo_size(&buf) < sizeof(struct chunk_hdr) + CHUNK)
+    {
+        printk(KERN_ERR "%s: fifo_size too small for compress mode\n",THIS_MODULE->name);
+        ret = -EINVAL;
+        goto out;
+    }
+    if(on && tfm == NULL)
+    {
+        if(wr_stage == NULL)
+            wr_stage = kmalloc(CHUNK, GFP_KERNEL);
+        if(rd_stage == NULL)
+            rd_stage = kmalloc(CHUNK, GFP_KERNEL);
+        if(cbuf == NULL)
+            cbuf = kmalloc(CHUNK, GFP_KERNEL);
+        if(wr_stage == NULL || rd_stage == NULL || cbuf == NULL)
+        {
+            ret = -ENOMEM;
+            goto out;
+        }
+        tfm = crypto_alloc_comp("lz4", 0, 0);
+        if(IS_ERR(tfm))
+        {
+            printk(KERN_ERR "%s: crypto_alloc_comp(lz4) failed\n",THIS_MODULE->name);
+            ret = PTR_ERR(tfm);
+            tfm = NULL;
+            goto out;
+        }
+    }
+    compress = on;
+out:
+    mutex_unlock(&fifo_lock);
+    return ret;
+}
+
 static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *poffset)
 {
     int ret ,nbytes;
+    struct pchar_file *pf = (struct pchar_file *)pfile->private_data;
     printk(KERN_INFO "%s pchar_read()\n",THIS_MODULE->name);
 
-    // interruptible sleep
-    ret = wait_event_interruptible(rd_wq, !kfifo_is_empty(&buf));
+    // interruptible sleep, bounded by hrtimer when a timeout or deadline is set
+    ret = wait_event_interruptible_hrtimeout(rd_wq, pchar_readable(), pchar_budget(pf, pf->rd_timeout));
+    if(ret == -ETIME)
+    {
+        printk(KERN_INFO "%s : pchar_read() timed out\n",THIS_MODULE->name);
+        return -ETIMEDOUT;
+    }
     if(ret != 0)
     {
         printk(KERN_INFO "%s : pchar_read() wake-up due to signal\n",THIS_MODULE->name);
@@ -160,7 +399,12 @@ static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *p
     }
 
 
-    ret =kfifo_to_user(&buf,ubuf,size,&nbytes);
+    mutex_lock(&fifo_lock);
+    if(compress)
+        ret = comp_out(ubuf,size,&nbytes);
+    else
+        ret =kfifo_to_user(&buf,ubuf,size,&nbytes);
+    mutex_unlock(&fifo_lock);
     if(ret < 0)
     {
         printk(KERN_ERR "%s pchar_read() to user failed\n",THIS_MODULE->name);
@@ -171,22 +415,157 @@ static ssize_t pchar_read(struct file *pfile, char *ubuf, size_t size, loff_t *p
     if(nbytes > 0)
         wake_up_interruptible(&wr_wq);
 
+    // a due delayed message was waiting for room
+    if(nbytes > 0 && delay_stalled)
+        queue_work(system_highpri_wq, &delay_work);
+
     return nbytes;
 }
 
+// drop the n oldest bytes. this moves the consumer index from the writer side, which is
+// only safe because every reader and writer of buf holds fifo_lock.
+static void fifo_skip(unsigned int n)
+{
+#ifdef kfifo_skip_count
+    kfifo_skip_count(&buf, n);
+#else
+    char scratch[64];
+    unsigned int got;
+
+    while(n > 0)
+    {
+        got = kfifo_out(&buf, scratch, min_t(unsigned int, n, sizeof(scratch)));
+        if(got == 0)
+            break;
+        n -= got;
+    }
+#endif
+}
+
+// queue len bytes making room by evicting the oldest ones, fifo_lock held
+static unsigned int fifo_in_evict(const char *kbuf, unsigned int len)
+{
+    unsigned int evict;
+
+    evict = len > kfifo_avail(&buf) ? len - kfifo_avail(&buf) : 0;
+    fifo_skip(evict);
+    kfifo_in(&buf, kbuf, len);
+    dropped += evict;
+    return evict;
+}
+
+// overwrite mode write: never blocks, keeps the most recent kfifo_size() bytes
+static ssize_t pchar_write_overwrite(const char *ubuf, size_t size)
+{
+    char *kbuf;
+    unsigned int len, evict, skip = 0;
+
+    len = size;
+    if(len > kfifo_size(&buf))
+    {
+        skip = len - kfifo_size(&buf);
+        len = kfifo_size(&buf);
+    }
+    kbuf = kmalloc(len, GFP_KERNEL);
+    if(kbuf == NULL)
+        return -ENOMEM;
+    if(copy_from_user(kbuf, ubuf + skip, len))
+    {
+        kfree(kbuf);
+        printk(KERN_ERR "%s pchar_write() overwrite copy failed\n",THIS_MODULE->name);
+        return -EFAULT;
+    }
+
+    mutex_lock(&fifo_lock);
+    evict = fifo_in_evict(kbuf, len);
+    dropped += skip;
+    mutex_unlock(&fifo_lock);
+    kfree(kbuf);
+    printk(KERN_INFO "%s pchar_write() overwrite %u data copy from user, %u dropped\n",THIS_MODULE->name,len,evict+skip);
+
+    wake_up_interruptible(&rd_wq);
+    return size;
+}
+
+// compress mode write: at most one chunk of raw bytes per call, 0 = no room for need bytes
+static ssize_t pchar_write_compress(const char *ubuf, size_t size, unsigned int need)
+{
+    char *kbuf;
+    unsigned int len = min_t(size_t, size, CHUNK);
+
+    kbuf = kmalloc(len, GFP_KERNEL);
+    if(kbuf == NULL)
+        return -ENOMEM;
+    if(copy_from_user(kbuf, ubuf, len))
+    {
+        kfree(kbuf);
+        printk(KERN_ERR "%s pchar_write() compress copy failed\n",THIS_MODULE->name);
+        return -EFAULT;
+    }
+    mutex_lock(&fifo_lock);
+    len = comp_room() >= need ? comp_in(kbuf, len) : 0;
+    mutex_unlock(&fifo_lock);
+    kfree(kbuf);
+    printk(KERN_INFO "%s pchar_write() compress %u data copy from user\n",THIS_MODULE->name,len);
+
+    if(len > 0)
+        wake_up_interruptible(&rd_wq);
+    return len;
+}
+
 static ssize_t pchar_write(struct file *pfile, const char *ubuf, size_t size, loff_t *poffset)
 {
     int ret, nbytes;
+    struct pchar_file *pf = (struct pchar_file *)pfile->private_data;
+    ktime_t budget, end;
+    unsigned int need;
     printk(KERN_INFO "%s pchar_write()\n",THIS_MODULE->name);
-    // interruptible sleep
-    ret = wait_event_interruptible(wr_wq, !kfifo_is_full(&buf));
+
+    // writes up to atomic_max land whole or not at all, like PIPE_BUF
+    need = 1;
+    if(size > 0 && size <= atomic_max && (!compress || size <= CHUNK))
+        need = size;
+
+    budget = pchar_budget(pf, pf->wr_timeout);
+    end = budget == KTIME_MAX ? KTIME_MAX : ktime_add(ktime_get(), budget);
+retry:
+    if((pfile->f_flags & O_NONBLOCK) && !pchar_writable(need))
+        return -EAGAIN;
+    if(end != KTIME_MAX)
+        budget = max_t(s64, ktime_sub(end, ktime_get()), 0);
+
+    // interruptible sleep, bounded by hrtimer when a timeout or deadline is set
+    ret = wait_event_interruptible_hrtimeout(wr_wq, pchar_writable(need), budget);
+    if(ret == -ETIME)
+    {
+        printk(KERN_INFO "%s : pchar_write() timed out\n",THIS_MODULE->name);
+        return -ETIMEDOUT;
+    }
     if(ret != 0)
     {
         printk(KERN_INFO "%s : pchar_write() wake-up due to signal\n",THIS_MODULE->name);
         return -ERESTARTSYS;
     }
 
+    if(overwrite)
+        return pchar_write_overwrite(ubuf, size);
+    if(compress)
+    {
+        // another writer took the room first
+        ret = pchar_write_compress(ubuf, size, need);
+        if(ret == 0)
+            goto retry;
+        return ret;
+    }
+
+    mutex_lock(&fifo_lock);
+    if(kfifo_avail(&buf) < need)
+    {
+        mutex_unlock(&fifo_lock);
+        goto retry;
+    }
     ret = kfifo_from_user(&buf,ubuf,size,&nbytes);
+    mutex_unlock(&fifo_lock);
     if(ret<0)
     {
         printk(KERN_ERR "%s pchar_write() failed\n",THIS_MODULE->name);
@@ -200,6 +579,261 @@ static ssize_t pchar_write(struct file *pfile, const char *ubuf, size_t size, lo
     return nbytes;
 }
 
+static int msg_before(struct delayed_msg *a, struct delayed_msg *b)
+{
+    return a->release < b->release || (a->release == b->release && a->seq < b->seq);
+}
+
+static void heap_push(struct delayed_msg *m)
+{
+    int i = heap_cnt++, parent;
+
+    while(i > 0)
+    {
+        parent = (i - 1) / 2;
+        if(!msg_before(m, heap[parent]))
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = m;
+}
+
+static void heap_pop(void)
+{
+    struct delayed_msg *last = heap[--heap_cnt];
+    int i = 0, child;
+
+    while((child = 2 * i + 1) < heap_cnt)
+    {
+        if(child + 1 < heap_cnt && msg_before(heap[child + 1], heap[child]))
+            child++;
+        if(!msg_before(heap[child], last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if(heap_cnt > 0)
+        heap[i] = last;
+}
+
+static int heap_grow(void)
+{
+    struct delayed_msg **tmp;
+    int cap = heap_cap ? heap_cap * 2 : 64;
+
+    tmp = kvmalloc_array(cap, sizeof(*tmp), GFP_KERNEL);
+    if(tmp == NULL)
+        return -ENOMEM;
+    if(heap_cnt > 0)
+        memcpy(tmp, heap, heap_cnt * sizeof(*tmp));
+    kvfree(heap);
+    heap = tmp;
+    heap_cap = cap;
+    return 0;
+}
+
+static enum hrtimer_restart delay_timer_fn(struct hrtimer *timer)
+{
+    // fifo_lock is a mutex, delivery happens in process context
+    queue_work(system_highpri_wq, &delay_work);
+    return HRTIMER_NORESTART;
+}
+
+// move every due message into the fifo, then re-arm for the next one
+static void delay_work_fn(struct work_struct *work)
+{
+    struct delayed_msg *m;
+    ktime_t now = ktime_get();
+    int moved = 0;
+
+    mutex_lock(&delay_lock);
+    mutex_lock(&fifo_lock);
+    delay_stalled = 0;
+    while(heap_cnt > 0 && heap[0]->release <= now)
+    {
+        m = heap[0];
+        if(overwrite)
+            fifo_in_evict(m->data, m->len);
+        else if(compress && comp_room() >= m->len)
+            comp_in(m->data, m->len);
+        else if(!compress && kfifo_avail(&buf) >= m->len)
+            kfifo_in(&buf, m->data, m->len);
+        else
+        {
+            delay_stalled = 1;
+            break;
+        }
+        heap_pop();
+        kfree(m);
+        moved++;
+    }
+    mutex_unlock(&fifo_lock);
+    if(heap_cnt > 0 && !delay_stalled)
+        hrtimer_start(&delay_timer, heap[0]->release, HRTIMER_MODE_ABS);
+    mutex_unlock(&delay_lock);
+
+    if(moved > 0)
+    {
+        printk(KERN_INFO "%s: %d delayed messages released\n",THIS_MODULE->name,moved);
+        wake_up_interruptible(&rd_wq);
+    }
+}
+
+static int pchar_send_at(delayed_t *ud)
+{
+    struct delayed_msg *m;
+    delayed_t *d;
+    int ret = 0;
+
+    d = kmalloc(sizeof(delayed_t), GFP_KERNEL);
+    if(d == NULL)
+        return -ENOMEM;
+    if(copy_from_user(d, ud, sizeof(delayed_t)))
+    {
+        ret = -EFAULT;
+        goto out;
+    }
+    // a message is released whole, so it must fit in the fifo
+    if(d->len <= 0 || d->len > DELAY_MAX || d->len > kfifo_size(&buf))
+    {
+        ret = -EINVAL;
+        goto out;
+    }
+    m = kmalloc(sizeof(struct delayed_msg) + d->len, GFP_KERNEL);
+    if(m == NULL)
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+    m->release = ns_to_ktime(d->release_ns);
+    m->len = d->len;
+    memcpy(m->data, d->data, d->len);
+
+    mutex_lock(&delay_lock);
+    if(heap_cnt >= max_delayed)
+        ret = -ENOSPC;
+    else if(heap_cnt == heap_cap)
+        ret = heap_grow();
+    if(ret != 0)
+    {
+        mutex_unlock(&delay_lock);
+        kfree(m);
+        goto out;
+    }
+    m->seq = heap_seq++;
+    heap_push(m);
+    // new earliest message: pull the timer in
+    if(heap[0] == m && !delay_stalled)
+        hrtimer_start(&delay_timer, m->release, HRTIMER_MODE_ABS);
+    mutex_unlock(&delay_lock);
+    printk(KERN_INFO "%s: delayed message of %d bytes queued, %d pending\n",THIS_MODULE->name,d->len,heap_cnt);
+out:
+    kfree(d);
+    return ret;
+}
+
+static ktime_t ms_to_timeout(int ms)
+{
+    return ms < 0 ? KTIME_MAX : ms_to_ktime(ms);
+}
+
+static int timeout_to_ms(ktime_t timeout)
+{
+    return timeout == KTIME_MAX ? -1 : (int)ktime_to_ms(timeout);
+}
+
+static long pchar_ioctl(struct file *pfile, unsigned int cmd, unsigned long param)
+{
+    struct pchar_file *pf = (struct pchar_file *)pfile->private_data;
+    timeout_t timeout;
+    long long deadline;
+    unsigned long long count;
+    comp_t comp;
+    int mode;
+
+    switch(cmd)
+    {
+        case FIFO_SET_TIMEOUT:
+            if(copy_from_user(&timeout, (void*)param, sizeof(timeout_t)))
+                return -EFAULT;
+            pf->rd_timeout = ms_to_timeout(timeout.rd_timeout_ms);
+            pf->wr_timeout = ms_to_timeout(timeout.wr_timeout_ms);
+            printk(KERN_INFO "%s: ioctl() set timeout rd=%dms wr=%dms\n",THIS_MODULE->name,timeout.rd_timeout_ms,timeout.wr_timeout_ms);
+            break;
+
+        case FIFO_GET_TIMEOUT:
+            timeout.rd_timeout_ms = timeout_to_ms(pf->rd_timeout);
+            timeout.wr_timeout_ms = timeout_to_ms(pf->wr_timeout);
+            if(copy_to_user((void*)param, &timeout, sizeof(timeout_t)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() get timeout\n",THIS_MODULE->name);
+            break;
+
+        case FIFO_SET_DEADLINE:
+            if(copy_from_user(&deadline, (void*)param, sizeof(deadline)))
+                return -EFAULT;
+            pf->deadline = deadline > 0 ? ns_to_ktime(deadline) : 0;
+            printk(KERN_INFO "%s: ioctl() set deadline %lld\n",THIS_MODULE->name,deadline);
+            break;
+
+        case FIFO_SET_OVERWRITE:
+            if(copy_from_user(&mode, (void*)param, sizeof(mode)))
+                return -EFAULT;
+            if(mode && compress)
+                return -EBUSY;
+            overwrite = mode ? 1 : 0;
+            // writers blocked on a full fifo can proceed now
+            wake_up_interruptible(&wr_wq);
+            printk(KERN_INFO "%s: ioctl() overwrite mode %s\n",THIS_MODULE->name,overwrite ? "on" : "off");
+            break;
+
+        case FIFO_SEND_AT:
+            printk(KERN_INFO "%s: ioctl() send at\n",THIS_MODULE->name);
+            return pchar_send_at((delayed_t *)param);
+
+        case FIFO_SET_ATOMIC:
+            if(copy_from_user(&mode, (void*)param, sizeof(mode)))
+                return -EFAULT;
+            // a larger write could never fit in one piece
+            if(mode < 0 || mode > kfifo_size(&buf))
+                return -EINVAL;
+            atomic_max = mode;
+            printk(KERN_INFO "%s: ioctl() atomic write threshold %d\n",THIS_MODULE->name,mode);
+            break;
+
+        case FIFO_SET_COMPRESS:
+            if(copy_from_user(&mode, (void*)param, sizeof(mode)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() compress mode %s\n",THIS_MODULE->name,mode ? "on" : "off");
+            return comp_enable(mode ? 1 : 0);
+
+        case FIFO_GET_COMP_STATS:
+            mutex_lock(&fifo_lock);
+            comp.raw_bytes = comp_raw;
+            comp.stored_bytes = comp_stored;
+            mutex_unlock(&fifo_lock);
+            if(copy_to_user((void*)param, &comp, sizeof(comp_t)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() compress stats\n",THIS_MODULE->name);
+            break;
+
+        case FIFO_GET_DROPPED:
+            mutex_lock(&fifo_lock);
+            count = dropped;
+            mutex_unlock(&fifo_lock);
+            if(copy_to_user((void*)param, &count, sizeof(count)))
+                return -EFAULT;
+            printk(KERN_INFO "%s: ioctl() dropped bytes %llu\n",THIS_MODULE->name,count);
+            break;
+
+        default:
+            printk(KERN_INFO "%s: ioctl() unsupported cmd\n",THIS_MODULE->name);
+            return -EINVAL;
+    }
+    return 0;
+}
+
 module_init(init_mod);
 module_exit(exit_mod);
 
@@ -0,0 +1,35 @@
+#ifndef __WAIT_H
+#define __WAIT_H
+
+#include "linux/ioctl.h"
+
+typedef struct{
+	int rd_timeout_ms;//read timeout, -1 = wait forever, 0 = do not wait
+	int wr_timeout_ms;//write timeout, -1 = wait forever, 0 = do not wait
+}timeout_t;
+
+#define DELAY_MAX 32
+
+typedef struct{
+	long long release_ns;//absolute CLOCK_MONOTONIC release time
+	int len;//message length, at most DELAY_MAX
+	char data[DELAY_MAX];
+}delayed_t;
+
+typedef struct{
+	unsigned long long raw_bytes;//bytes written in compress mode
+	unsigned long long stored_bytes;//fifo bytes they took, raw/stored is the ratio
+}comp_t;
+
+
+#define FIFO_SET_TIMEOUT _IOW('x',4,timeout_t)
+#define FIFO_GET_TIMEOUT _IOR('x',5,timeout_t)
+#define FIFO_SET_DEADLINE _IOW('x',6,long long)//absolute CLOCK_MONOTONIC ns, 0 = no deadline
+#define FIFO_SET_OVERWRITE _IOW('x',7,int)//1 = full fifo evicts oldest bytes, 0 = writer blocks
+#define FIFO_GET_DROPPED _IOR('x',8,unsigned long long)//bytes evicted in overwrite mode
+#define FIFO_SEND_AT _IOW('x',16,delayed_t)//queue a message released into the fifo at release_ns
+#define FIFO_SET_COMPRESS _IOW('x',17,int)//1 = lz4 compress fifo contents, fifo must be empty
+#define FIFO_GET_COMP_STATS _IOR('x',18,comp_t)
+#define FIFO_SET_ATOMIC _IOW('x',19,int)//writes up to this many bytes are never split, 0 = off
+
+#endif
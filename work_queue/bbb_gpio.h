@@ -0,0 +1,66 @@
+#ifndef __BBB_GPIO_H
+#define __BBB_GPIO_H
+
+#include "linux/ioctl.h"
+
+#define EDGE_FALLING 0
+#define EDGE_RISING 1
+
+//one switch edge, read() returns an array of these
+typedef struct{
+	unsigned long long ts_ns;//CLOCK_MONOTONIC time of the edge, taken in the isr
+	unsigned int seq;//edge counter, a gap means events were dropped
+	unsigned char edge;//EDGE_RISING or EDGE_FALLING
+	unsigned char pad[3];
+}gpio_event_t;
+
+//waveform write: a header followed by steps or by a bitstream.
+//write() returns the header size plus the payload queued. a short count means only the
+//first steps, or whole bytes of bits, were queued: send the rest behind a new header.
+#define WAVE_MAGIC 0x57415645//"WAVE"
+#define WAVE_MORE 0x1//more data follows, running dry after this write is an underrun
+
+typedef struct{
+	unsigned int magic;//WAVE_MAGIC
+	unsigned int flags;//WAVE_MORE
+	unsigned int rate_hz;//0 = count wave_step_t follow, else count bits sampled at rate_hz (at most 100000), msb first
+	unsigned int count;
+}wave_hdr_t;
+
+typedef struct{
+	unsigned int level;//0 = off, anything else = on
+	unsigned int duration_ns;//at least 10000
+}wave_step_t;
+
+//pin banks, bit i = pin i of the bank as listed in the out_gpios/in_gpios module params
+typedef struct{
+	int out_cnt;//output pins, pin 0 is the led
+	int in_cnt;//input pins, pin 0 is the switch
+}bank_info_t;
+
+typedef struct{
+	unsigned int mask;//output pins to change
+	unsigned int values;//their new levels
+}bank_t;
+
+#define BANK_INFO _IOR('x',21,bank_info_t)
+#define BANK_GET_IN _IOR('x',22,unsigned int)//levels of all input pins
+#define BANK_GET_OUT _IOR('x',23,unsigned int)//levels of all output pins
+#define BANK_SET_OUT _IOW('x',24,bank_t)//set the masked output pins in one update
+
+//sampling mode: read() on the file returns the switch level packed 8 samples per byte, msb first
+typedef struct{
+	unsigned long long samples;//taken since SAMPLE_START
+	unsigned long long lost;//dropped because readers fell behind
+	unsigned long long missed;//sample periods the timer slept through
+	unsigned long long max_jitter_ns;//worst lateness of a sample against its deadline
+	unsigned long long avg_jitter_ns;
+}sample_stats_t;
+
+//there is one sampler: the file that started it owns it until SAMPLE_STOP or close,
+//SAMPLE_START and SAMPLE_STOP on other files fail with EBUSY meanwhile
+#define SAMPLE_START _IOW('x',25,unsigned int)//rate in Hz, switches this file's read() to samples
+#define SAMPLE_STOP _IO('x',26)//stops sampling, this file's read() returns events again
+#define SAMPLE_STATS _IOR('x',27,sample_stats_t)
+
+#endif
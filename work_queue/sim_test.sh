@@ -0,0 +1,160 @@
+#!/bin/bash
+# run the bbb_gpio driver on any linux box or qemu guest, no beaglebone needed.
+# gpio-sim (or gpio-mockup on older kernels) provides two lines: 0 is the led, 1 is the switch.
+# the switch is driven through its simulated pull, the led is read back from the simulator.
+# build first with: make native test
+# usage: sudo ./sim_test.sh [edges per rate] [rates, "max" = as fast as the shell goes]
+# e.g.   sudo ./sim_test.sh 400 "100 1000 max"
+
+EDGES=${1:-200}
+RATES=${2:-"100 1000 max"}
+SIM=/sys/kernel/config/gpio-sim/bbb_gpio
+DBG=/sys/kernel/debug
+ATTR=/sys/class/bbb_gpio_class/bbb_gpio0
+DEV=/dev/bbb_gpio0
+MODE=
+LINES=
+READER=
+FAILED=0
+
+cd "$(dirname "$0")" || exit 1
+
+cleanup()
+{
+	[ -n "$READER" ] && kill $READER 2>/dev/null
+	rmmod work_queue 2>/dev/null
+	if [ "$MODE" = sim ]; then
+		echo 0 > $SIM/live
+		rmdir $SIM/gpio-bank0 $SIM
+	elif [ "$MODE" = mockup ]; then
+		rmmod gpio-mockup
+	fi
+}
+trap cleanup EXIT
+
+check()
+{
+	if [ "$2" = "$3" ]; then
+		echo "PASS: $1"
+	else
+		echo "FAIL: $1 (expected $3, got $2)"
+		FAILED=1
+	fi
+}
+
+# legacy number of the first line of a chip, the driver takes pins by number
+chip_base()
+{
+	sed -n "s/^$1: GPIOs \([0-9]*\)-.*/\1/p" $DBG/gpio
+}
+
+sim_setup()
+{
+	modprobe gpio-sim 2>/dev/null || return 1
+	mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+	mkdir $SIM $SIM/gpio-bank0 || return 1
+	echo 2 > $SIM/gpio-bank0/num_lines
+	echo 1 > $SIM/live || return 1
+	MODE=sim
+	CHIP=$(cat $SIM/gpio-bank0/chip_name)
+	LINES=/sys/devices/platform/$(cat $SIM/dev_name)/$CHIP
+}
+
+mockup_setup()
+{
+	modprobe gpio-mockup gpio_mockup_ranges=-1,2 || return 1
+	MODE=mockup
+	CHIP=$(sed -n 's/^\(gpiochip[0-9]*\): .*gpio-mockup-A.*/\1/p' $DBG/gpio)
+	LINES=$DBG/gpio-mockup/$CHIP
+}
+
+switch_set()
+{
+	if [ $MODE = sim ]; then
+		[ $1 = 1 ] && echo pull-up > $LINES/sim_gpio1/pull || echo pull-down > $LINES/sim_gpio1/pull
+	else
+		echo $1 > $LINES/1
+	fi
+}
+
+led_get()
+{
+	if [ $MODE = sim ]; then
+		cat $LINES/sim_gpio0/value
+	else
+		cat $LINES/0
+	fi
+}
+
+# one press and release per two edges, paced to the requested edge rate
+toggle()
+{
+	local n=$1 rate=$2 pause=0 i
+
+	[ $rate != max ] && pause=$(awk "BEGIN{printf \"%.6f\", 1/$rate}")
+	for((i=0; i<n; i+=2)); do
+		switch_set 1
+		[ $rate != max ] && sleep $pause
+		switch_set 0
+		[ $rate != max ] && sleep $pause
+	done
+}
+
+mountpoint -q $DBG || mount -t debugfs none $DBG
+if [ ! -f work_queue.ko ] || [ ! -x test ]; then
+	echo "build first: make native test"
+	exit 1
+fi
+sim_setup || mockup_setup || { echo "neither gpio-sim nor gpio-mockup is available"; exit 1; }
+BASE=$(chip_base $CHIP)
+echo "$MODE chip $CHIP, led gpio $BASE, switch gpio $((BASE+1))"
+
+# short pattern so a press is visible on the led within the test
+insmod ./work_queue.ko out_gpios=$BASE in_gpios=$((BASE+1)) pattern_us=50000,50000 pattern_repeat=1 || exit 1
+sleep 0.1
+
+# led writes reach the line
+./test led 0; sleep 0.05
+check "led off" "$(led_get)" 0
+./test led 1; sleep 0.05
+check "led on" "$(led_get)" 1
+./test led 0; sleep 0.05
+
+# a press starts the pattern: on for 50 ms, then off
+switch_set 1; switch_set 0; sleep 0.02
+check "press starts pattern" "$(led_get)" 1
+sleep 0.15
+check "pattern ends" "$(led_get)" 0
+
+# drain the press above so each rate starts from an empty ring
+timeout 1 ./test events 2 > /dev/null
+
+for rate in $RATES; do
+	OUT=$(mktemp)
+	[ -w $DBG/bbb_gpio/reset ] && echo 1 > $DBG/bbb_gpio/reset
+	DROPPED=$(cat $ATTR/events_dropped)
+	timeout 30 ./test events $EDGES > $OUT &
+	READER=$!
+	sleep 0.2
+
+	T0=$(date +%s%N)
+	toggle $EDGES $rate
+	T1=$(date +%s%N)
+	wait $READER
+	READER=
+
+	GOT=$(grep -c '^seq' $OUT)
+	GAPS=$(awk '/^seq/ { if(NR > 1 && $2 != prev + 1) gaps++; prev = $2 } END { print gaps + 0 }' $OUT)
+	echo "rate $rate: $EDGES edges in $(( (T1 - T0) / 1000000 )) ms," \
+		"$(( EDGES * 1000000000 / (T1 - T0 + 1) )) edges/s, $GOT delivered," \
+		"$(( $(cat $ATTR/events_dropped) - DROPPED )) dropped"
+	check "rate $rate: every edge delivered" $GOT $EDGES
+	check "rate $rate: seq has no gaps" $GAPS 0
+	[ -r $DBG/bbb_gpio/latency ] && sed 's/^/    /' $DBG/bbb_gpio/latency
+	rm -f $OUT
+done
+
+echo "irq_storm: $(cat $ATTR/irq_storm)"
+echo "debounce: $(cat $ATTR/debounce_stats)"
+[ $FAILED = 0 ] && echo "all tests passed" || echo "some tests failed"
+exit $FAILED
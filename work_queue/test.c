@@ -0,0 +1,152 @@
+#include<stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "bbb_gpio.h"
+
+static void usage(const char *name)
+{
+	printf("invalid usage\n");
+	printf("usage1: %s led <0|1>\n",name);
+	printf("usage2: %s events <count>\n",name);
+	printf("usage3: %s wave <rate_hz> <bits e.g. 1100101>\n",name);
+	printf("usage4: %s bank get\n",name);
+	printf("usage5: %s bank set <mask> <values>\n",name);
+	printf("usage6: %s sample <rate_hz> <count>\n",name);
+}
+
+int main(int argc, char *argv[])
+{
+	int fd,ret,i,count;
+	gpio_event_t ev[64];
+	struct pollfd pfd;
+	bank_info_t info;
+	bank_t bank;
+	unsigned int in, out, rate;
+	unsigned char samples[512];
+	sample_stats_t st;
+	struct{
+		wave_hdr_t hdr;
+		unsigned char bits[256];
+	}wave;
+
+	if(argc<3)
+	{
+		usage(argv[0]);
+		_exit(2);
+	}
+
+	fd = open("/dev/bbb_gpio0", O_RDWR);
+	if(fd<0)
+	{
+		perror("open() failed");
+		_exit(1);
+	}
+
+	if(strcmp(argv[1],"led") == 0)
+	{
+		ret = write(fd, argv[2], 1);
+		if(ret < 0)
+			perror("write() failed");
+	}
+	else if(strcmp(argv[1],"events") == 0)
+	{
+		//wait for edges with poll(), then drain everything queued in one read()
+		count = atoi(argv[2]);
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		while(count > 0)
+		{
+			ret = poll(&pfd, 1, -1);
+			if(ret < 0)
+			{
+				perror("poll() failed");
+				break;
+			}
+			ret = read(fd, ev, sizeof(ev));
+			if(ret < 0)
+			{
+				perror("read() failed");
+				break;
+			}
+			for(i=0; i<ret/(int)sizeof(gpio_event_t); i++, count--)
+				printf("seq %u %s at %llu ns\n", ev[i].seq, ev[i].edge == EDGE_RISING ? "rising" : "falling", ev[i].ts_ns);
+		}
+	}
+	else if(strcmp(argv[1],"wave") == 0 && argc==4 && atoi(argv[2]) > 0)
+	{
+		//one write, the kernel plays the bitstream from an hrtimer
+		memset(&wave, 0, sizeof(wave));
+		wave.hdr.magic = WAVE_MAGIC;
+		wave.hdr.rate_hz = atoi(argv[2]);
+		for(i=0; argv[3][i] != '\0' && i < 8*(int)sizeof(wave.bits); i++)
+			if(argv[3][i] == '1')
+				wave.bits[i/8] |= 0x80 >> (i%8);
+		count = i;
+		while(i > 0)
+		{
+			wave.hdr.count = i;
+			ret = write(fd, &wave, sizeof(wave.hdr) + (i+7)/8);
+			if(ret < 0)
+				break;
+			//short count: the leading bytes were queued, the rest goes again behind the header
+			ret -= sizeof(wave.hdr);
+			memmove(wave.bits, wave.bits + ret, sizeof(wave.bits) - ret);
+			i -= 8*ret < i ? 8*ret : i;
+		}
+		if(i > 0)
+			perror("write() failed");
+		else
+			printf("%d bits queued at %u Hz\n", count, wave.hdr.rate_hz);
+	}
+	else if(strcmp(argv[1],"bank") == 0 && strcmp(argv[2],"get") == 0)
+	{
+		if(ioctl(fd, BANK_INFO, &info) != 0 || ioctl(fd, BANK_GET_IN, &in) != 0 || ioctl(fd, BANK_GET_OUT, &out) != 0)
+			perror("ioctl() failed");
+		else
+			printf("in: %d pins = 0x%x, out: %d pins = 0x%x\n", info.in_cnt, in, info.out_cnt, out);
+	}
+	else if(strcmp(argv[1],"bank") == 0 && strcmp(argv[2],"set") == 0 && argc==5)
+	{
+		bank.mask = strtoul(argv[3], NULL, 0);
+		bank.values = strtoul(argv[4], NULL, 0);
+		if(ioctl(fd, BANK_SET_OUT, &bank) != 0)
+			perror("ioctl() failed");
+	}
+	else if(strcmp(argv[1],"sample") == 0 && argc==4 && atoi(argv[2]) > 0)
+	{
+		//switch level packed 8 samples per byte, each read() drains what is ready
+		rate = atoi(argv[2]);
+		count = atoi(argv[3]);
+		if(ioctl(fd, SAMPLE_START, &rate) != 0)
+		{
+			perror("ioctl() failed");
+			close(fd);
+			_exit(1);
+		}
+		while(count > 0)
+		{
+			ret = read(fd, samples, sizeof(samples));
+			if(ret < 0)
+			{
+				perror("read() failed");
+				break;
+			}
+			for(i=0; i<8*ret && count > 0; i++, count--)
+				putchar(samples[i/8] & (0x80 >> (i%8)) ? '1' : '0');
+		}
+		putchar('\n');
+		if(ioctl(fd, SAMPLE_STATS, &st) == 0)
+			printf("%llu samples, %llu lost, %llu missed, jitter avg %llu ns max %llu ns\n",
+				st.samples, st.lost, st.missed, st.avg_jitter_ns, st.max_jitter_ns);
+		ioctl(fd, SAMPLE_STOP);
+	}
+	else
+		usage(argv[0]);
+
+	close(fd);
+	return 0;
+}
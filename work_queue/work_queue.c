@@ -4,10 +4,23 @@
 #include<linux/device.h>
 #include<linux/init.h>
 #include<linux/gpio.h>
+#include<linux/gpio/consumer.h>
+#include<linux/bitmap.h>
+#include<linux/slab.h>
 #include<linux/uaccess.h>
 #include<linux/interrupt.h>
 #include<linux/workqueue.h>
 #include<linux/delay.h>
+#include<linux/hrtimer.h>
+#include<linux/ktime.h>
+#include<linux/spinlock.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
+#include<linux/mutex.h>
+#include<linux/debugfs.h>
+#include<linux/seq_file.h>
+#include<linux/log2.h>
+#include "bbb_gpio.h"
 
 #define LED_GPIO    49
 #define SWITCH_GPIO 115
@@ -16,6 +29,9 @@ static int bbb_gpio_open(struct inode *, struct file *);
 static int bbb_gpio_close(struct inode *, struct file *);
 static ssize_t bbb_gpio_read(struct file *, char *, size_t, loff_t *);
 static ssize_t bbb_gpio_write(struct file *, const char *, size_t, loff_t *);
+static __poll_t bbb_gpio_poll(struct file *, poll_table *);
+static long bbb_gpio_ioctl(struct file *, unsigned int, unsigned long);
+static void wave_stop(void);
 
 #define MAX 32
 static int led_state;
@@ -24,36 +40,922 @@ static dev_t devno;
 int major;
 static struct class *pclass;
 static int irq;
-static struct work_struct work_queue;
+static struct work_struct work_queue;//applies led_state on controllers whose gpio writes sleep
+static struct workqueue_struct *gpio_wq;//WQ_HIGHPRI, keeps our work out of the shared system pool
+
+//pin banks by legacy number, held as descriptors. pin 0 of each bank is the led and the switch.
+#define BANK_MAX 32
+static int out_gpios[BANK_MAX] = {LED_GPIO};
+static int out_cnt = 1;
+module_param_array(out_gpios, int, &out_cnt, 0444);
+MODULE_PARM_DESC(out_gpios, "output bank, the first pin is the led");
+static int in_gpios[BANK_MAX] = {SWITCH_GPIO};
+static int in_cnt = 1;
+module_param_array(in_gpios, int, &in_cnt, 0444);
+MODULE_PARM_DESC(in_gpios, "input bank, the first pin is the switch");
+static struct gpio_desc *out_descs[BANK_MAX];
+static struct gpio_desc *in_descs[BANK_MAX];
+#define led_gpiod (out_descs[0])
+#define switch_gpiod (in_descs[0])
+
+//led pattern: step durations in us, alternating on/off starting with on.
+//the default reproduces the old blink, ten 500 ms toggles.
+#define PATTERN_MAX 32
+static unsigned int pattern_us[PATTERN_MAX] = {500000, 500000};
+static int pattern_len = 2;
+module_param_array(pattern_us, uint, &pattern_len, 0644);
+MODULE_PARM_DESC(pattern_us, "led on/off step durations in us, starting with on");
+static int pattern_repeat = 5;
+module_param(pattern_repeat, int, 0644);
+MODULE_PARM_DESC(pattern_repeat, "times the pattern is played per press, 0 = until the next press");
+static int press_cancels;
+module_param(press_cancels, int, 0644);
+MODULE_PARM_DESC(press_cancels, "0 = a press restarts the pattern, 1 = a press during playback stops it");
+
+static struct hrtimer pat_timer;
+static DEFINE_SPINLOCK(pat_lock);//pattern state below, taken from irq and timer context
+static unsigned int pat_steps[PATTERN_MAX];//snapshot of pattern_us taken at start
+static int pat_len, pat_idx, pat_rep, pat_repeat;
+static bool pat_active;
+static u64 pat_edge_ts;//edge that started the pattern, handed to the led work of its first step
+static bool led_cansleep;
+static bool switch_cansleep;//gpio-sim, i2c expanders: threaded isr, nothing samples it from a timer
+
+//waveform playback, double buffered: the timer plays one buffer while writers fill the other
+#define WAVE_BUF 256//steps per buffer
+#define WAVE_MIN_NS 10000//shortest step, shorter ones would keep a cpu in timer interrupts
+struct wave_buf
+{
+    wave_step_t steps[WAVE_BUF];
+    unsigned int len;
+    bool ready;//filled, waiting for or under playback
+    bool more;//the writer said more data follows this buffer
+};
+static struct wave_buf wave[2];
+static int wave_play;//buffer being played
+static unsigned int wave_pos;
+static bool wave_running;
+static unsigned int wave_gen;//bumped by wave_stop(), buffers filled before it are not queued
+static unsigned long wave_steps, wave_underruns;
+static struct hrtimer wave_timer;
+static DEFINE_SPINLOCK(wave_lock);//playback state, taken from irq and timer context
+static DEFINE_MUTEX(wave_mutex);//one writer fills buffers at a time
+static DECLARE_WAIT_QUEUE_HEAD(wave_wq);//woken when the timer hands a buffer back
+
+//switch edges, single producer (the isr) and readers serialized by ev_lock
+#define EVENT_RING 256//entries, power of 2
+static gpio_event_t ev_ring[EVENT_RING];
+static unsigned int ev_head;//written by the isr only
+static unsigned int ev_tail;//written by readers only
+static unsigned int ev_seq;
+static unsigned long ev_dropped;//edges lost to a full ring
+static DEFINE_MUTEX(ev_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ev_wq);
+
+//sampling mode, the timer is the only producer and readers are serialized by smp_lock
+#define SAMPLE_BYTES 8192//ring of packed samples, power of 2
+static unsigned int sample_max_hz = 100000;
+module_param(sample_max_hz, uint, 0644);
+MODULE_PARM_DESC(sample_max_hz, "highest rate SAMPLE_START accepts");
+static unsigned char smp_ring[SAMPLE_BYTES];
+static unsigned int smp_head;//bits written, by the timer only
+static unsigned int smp_tail;//bits consumed, always a multiple of 8, by readers only
+static bool smp_running;
+static struct file *smp_owner;//file that started sampling, the only one that may restart or stop it
+static u64 smp_period_ns;
+static u64 smp_samples, smp_lost, smp_missed, smp_jitter_max, smp_jitter_sum;
+static struct hrtimer smp_timer;
+static DEFINE_MUTEX(smp_lock);//readers, and start/stop against each other
+static DECLARE_WAIT_QUEUE_HEAD(smp_wq);
+
+//per open file
+struct bbb_file
+{
+    bool samples;//read() returns samples instead of events
+};
+
+//switch debounce, in hardware when the controller can, otherwise with an hrtimer window
+static unsigned int debounce_us = 40;
+module_param(debounce_us, uint, 0644);
+MODULE_PARM_DESC(debounce_us, "switch debounce window in us");
+static int soft_debounce = -1;
+module_param(soft_debounce, int, 0444);
+MODULE_PARM_DESC(soft_debounce, "-1 = only if gpio_set_debounce fails, 0 = never, 1 = always");
+static bool db_soft;
+static struct hrtimer db_timer;
+static u64 db_ts;//time of the edge that opened the window
+static int db_level;//last confirmed switch level
+static unsigned long sw_irqs, db_accepted, db_rejected;
+
+//irq storm: past storm_irq_rate the line is masked and polled from an hrtimer until it goes quiet
+#define STORM_WINDOW_NS (10 * NSEC_PER_MSEC)//irq rate is measured over this window
+static unsigned int storm_irq_rate = 2000;
+module_param(storm_irq_rate, uint, 0644);
+MODULE_PARM_DESC(storm_irq_rate, "switch irqs per second that switch to polling, 0 = never");
+static unsigned int storm_poll_us = 1000;
+module_param(storm_poll_us, uint, 0644);
+MODULE_PARM_DESC(storm_poll_us, "switch poll period while in storm mode");
+static unsigned int storm_quiet_ms = 100;
+module_param(storm_quiet_ms, uint, 0644);
+MODULE_PARM_DESC(storm_quiet_ms, "level must be stable this long before irqs come back");
+static bool storm_mode;//line masked, storm_timer owns it
+static struct hrtimer storm_timer;
+static u64 storm_win_start, storm_last_change;
+static unsigned int storm_win_irqs;
+static int storm_level;
+static unsigned long storm_irq_hz;//irq rate of the last full window
+static unsigned long storm_enters, storm_exits, storm_polls;
+
+//latency of each stage after a switch edge, log2 histograms in debugfs bbb_gpio/latency.
+//the edge itself is only known when the driver made it: loop the led back to the switch.
+#define LAT_BUCKETS 16//bucket 0 is < 1 us, bucket i is < 2^i us, the last one takes the rest
+#define LAT_STIM_NS (10 * NSEC_PER_MSEC)//an irq later than this after an led write is not its echo
+enum { LAT_ISR, LAT_WORK, LAT_READER, LAT_STAGES };
+static const char *lat_names[LAT_STAGES] = { "edge->isr", "isr->work_handler", "isr->reader" };
+struct lat_stage
+{
+    unsigned long hist[LAT_BUCKETS];
+    unsigned long count;
+    u64 sum, max;//ns
+};
+static struct lat_stage lat[LAT_STAGES];
+static u64 lat_stim;//led written, edge expected on a looped back switch
+static u64 lat_work_ts;//edge whose led change is queued, consumed by the next work_handler
+static DEFINE_SPINLOCK(lat_lock);//all latency state, taken from irq, work and reader context
+static struct dentry *lat_dir;
+static int led_work;
+module_param(led_work, int, 0644);
+MODULE_PARM_DESC(led_work, "1 = drive the led from the workqueue even when the gpio does not sleep");
 
 static struct file_operations bbb_gpio_fops = {
     .owner = THIS_MODULE,
     .read = bbb_gpio_read,
     .write = bbb_gpio_write,
     .open = bbb_gpio_open,
-    .release = bbb_gpio_close
+    .release = bbb_gpio_close,
+    .poll = bbb_gpio_poll,
+    .unlocked_ioctl = bbb_gpio_ioctl
 };
 
+static void lat_record(int stage, u64 ns)
+{
+    u64 us = div_u64(ns, NSEC_PER_USEC);
+    int b = us ? min_t(int, ilog2(us) + 1, LAT_BUCKETS - 1) : 0;
+
+    lat[stage].hist[b]++;
+    lat[stage].count++;
+    lat[stage].sum += ns;
+    if(ns > lat[stage].max)
+        lat[stage].max = ns;
+}
+
+// the led is about to change, a looped back switch sees the edge now
+static void lat_stimulus(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&lat_lock, flags);
+    lat_stim = ktime_get_ns();
+    spin_unlock_irqrestore(&lat_lock, flags);
+}
+
+// isr entry: closes the led write to isr stage
+static void lat_isr(u64 ts)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&lat_lock, flags);
+    if(lat_stim && ts > lat_stim && ts - lat_stim < LAT_STIM_NS)
+        lat_record(LAT_ISR, ts - lat_stim);
+    lat_stim = 0;
+    spin_unlock_irqrestore(&lat_lock, flags);
+}
+
+// an edge queued led work: opens the work stage, the oldest edge still pending wins
+static void lat_work_queued(u64 ts)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&lat_lock, flags);
+    if(!lat_work_ts)
+        lat_work_ts = ts;
+    spin_unlock_irqrestore(&lat_lock, flags);
+}
+
 static void work_handler(struct work_struct *work_qu)
 {
+    u64 now = ktime_get_ns();
+    unsigned long flags;
+
+    spin_lock_irqsave(&lat_lock, flags);
+    if(lat_work_ts)
+        lat_record(LAT_WORK, now - lat_work_ts);
+    lat_work_ts = 0;
+    spin_unlock_irqrestore(&lat_lock, flags);
+
+    lat_stimulus();
+    gpiod_set_value_cansleep(led_gpiod, READ_ONCE(led_state));
+}
+
+// edge_ts is the edge this change answers, 0 for writes and waveforms
+static void led_apply_edge(int state, u64 edge_ts)
+{
+    WRITE_ONCE(led_state, state);
+    if(led_cansleep || led_work)
+    {
+        if(edge_ts)
+            lat_work_queued(edge_ts);
+        queue_work(gpio_wq, &work_queue);
+    }
+    else
+    {
+        lat_stimulus();
+        gpiod_set_value(led_gpiod, state);
+    }
+}
+
+static void led_apply(int state)
+{
+    led_apply_edge(state, 0);
+}
+
+// one pattern step per expiry, re-armed from the previous deadline so steps do not drift
+static enum hrtimer_restart pat_timer_fn(struct hrtimer *timer)
+{
+    unsigned long flags;
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+
+    spin_lock_irqsave(&pat_lock, flags);
+    // restarted by a press while we waited for the lock, the new run owns the timer
+    if(hrtimer_is_queued(timer) || !pat_active)
+        goto out;
+    if(pat_idx == pat_len)
+    {
+        pat_idx = 0;
+        if(pat_repeat > 0 && ++pat_rep == pat_repeat)
+        {
+            // last step done, we hold pat_lock already and simply do not re-arm
+            pat_active = false;
+            led_apply(0);
+            goto out;
+        }
+    }
+    // even steps are on, odd steps are off, the first one carries the edge that started the run
+    led_apply_edge(!(pat_idx & 1), pat_edge_ts);
+    pat_edge_ts = 0;
+    hrtimer_forward(timer, hrtimer_get_expires(timer), ns_to_ktime((u64)pat_steps[pat_idx] * NSEC_PER_USEC));
+    pat_idx++;
+    ret = HRTIMER_RESTART;
+out:
+    spin_unlock_irqrestore(&pat_lock, flags);
+    return ret;
+}
+
+// start the pattern from its first step, callable from any context.
+// ts is the edge that asked for it, its first step is timed against that edge
+static void pattern_start(u64 ts)
+{
+    unsigned long flags;
     int i;
-    for(i=1; i<=10; i++)
+
+    // a press takes the led back from a waveform
+    wave_stop();
+    spin_lock_irqsave(&pat_lock, flags);
+    pat_len = min(pattern_len, PATTERN_MAX);
+    for(i=0; i<pat_len; i++)
+        pat_steps[i] = max(pattern_us[i], 1U);
+    pat_repeat = pattern_repeat;
+    pat_idx = 0;
+    pat_rep = 0;
+    pat_edge_ts = ts;
+    pat_active = pat_len > 0;
+    if(pat_active)
+        hrtimer_start(&pat_timer, ktime_get(), HRTIMER_MODE_ABS);
+    spin_unlock_irqrestore(&pat_lock, flags);
+}
+
+static void pattern_stop(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&pat_lock, flags);
+    pat_active = false;
+    hrtimer_try_to_cancel(&pat_timer);
+    spin_unlock_irqrestore(&pat_lock, flags);
+}
+
+static enum hrtimer_restart wave_timer_fn(struct hrtimer *timer)
+{
+    unsigned long flags;
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+    wave_step_t *step;
+    struct wave_buf *wb;
+
+    spin_lock_irqsave(&wave_lock, flags);
+    if(hrtimer_is_queued(timer) || !wave_running)
+        goto out;
+    wb = &wave[wave_play];
+    if(wave_pos == wb->len)
     {
-        gpio_set_value(LED_GPIO, led_state);
-        led_state = !led_state;
-        msleep(500);
+        // buffer played out, hand it back to the writers and switch to the other one
+        if(!wave[!wave_play].ready && wb->more)
+            wave_underruns++;
+        wb->ready = false;
+        wb->len = 0;
+        wake_up_interruptible(&wave_wq);
+        wave_play = !wave_play;
+        wave_pos = 0;
+        wb = &wave[wave_play];
+        if(!wb->ready)
+        {
+            wave_running = false;
+            goto out;
+        }
     }
-    printk(KERN_INFO "%s: work_handler() called\n",THIS_MODULE->name);
+    step = &wb->steps[wave_pos++];
+    led_apply(step->level != 0);
+    wave_steps++;
+    hrtimer_forward(timer, hrtimer_get_expires(timer), ns_to_ktime(step->duration_ns));
+    ret = HRTIMER_RESTART;
+out:
+    spin_unlock_irqrestore(&wave_lock, flags);
+    return ret;
+}
+
+// drop queued waveform data, callable from any context
+static void wave_stop(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&wave_lock, flags);
+    wave_running = false;
+    wave_gen++;
+    hrtimer_try_to_cancel(&wave_timer);
+    wave[0].ready = wave[1].ready = false;
+    wave[0].len = wave[1].len = 0;
+    wake_up_interruptible(&wave_wq);
+    spin_unlock_irqrestore(&wave_lock, flags);
+}
+
+// buffer a writer may fill, -1 if both are queued or playing
+static int wave_free(void)
+{
+    unsigned long flags;
+    int i, idx = -1;
+
+    spin_lock_irqsave(&wave_lock, flags);
+    for(i=0; i<2; i++)
+        if(!wave[i].ready)
+            idx = i;
+    spin_unlock_irqrestore(&wave_lock, flags);
+    return idx;
+}
+
+// queue a filled buffer and start playback if the player is idle.
+// false if wave_stop() ran since the writer started, the buffer is dropped then.
+static bool wave_submit(int idx, bool more, unsigned int gen)
+{
+    unsigned long flags;
+    bool ok;
+
+    spin_lock_irqsave(&wave_lock, flags);
+    ok = gen == wave_gen;
+    if(ok)
+    {
+        wave[idx].more = more;
+        wave[idx].ready = true;
+        if(!wave_running)
+        {
+            wave_play = idx;
+            wave_pos = 0;
+            wave_running = true;
+            hrtimer_start(&wave_timer, ktime_get(), HRTIMER_MODE_ABS);
+        }
+    }
+    spin_unlock_irqrestore(&wave_lock, flags);
+    return ok;
+}
+
+// wait for a free buffer, it is empty when returned
+static int wave_get(struct file *pfile)
+{
+    int idx, ret;
+
+    if(pfile->f_flags & O_NONBLOCK)
+        return (idx = wave_free()) < 0 ? -EAGAIN : idx;
+    ret = wait_event_interruptible(wave_wq, (idx = wave_free()) >= 0);
+    return ret != 0 ? -ERESTARTSYS : idx;
+}
+
+// steps are copied straight into the buffers, *done counts the steps queued
+static int wave_write_steps(struct file *pfile, const char *ubuf, unsigned int count, bool more,
+        unsigned int gen, unsigned int *done)
+{
+    unsigned int n, i;
+    int idx;
+
+    *done = 0;
+    while(*done < count)
+    {
+        idx = wave_get(pfile);
+        if(idx < 0)
+            return idx;
+        n = min(count - *done, (unsigned int)WAVE_BUF);
+        if(copy_from_user(wave[idx].steps, ubuf, n * sizeof(wave_step_t)))
+            return -EFAULT;
+        for(i=0; i<n; i++)
+            if(wave[idx].steps[i].duration_ns < WAVE_MIN_NS)
+                return -EINVAL;
+        wave[idx].len = n;
+        ubuf += n * sizeof(wave_step_t);
+        if(!wave_submit(idx, *done + n < count || more, gen))
+            return -ECANCELED;
+        *done += n;
+    }
+    return 0;
+}
+
+// a bitstream is run-length coded into steps, run edges are placed from the
+// absolute bit index so rounding of the bit period does not accumulate.
+// buffers are closed on byte boundaries, so *done, the bits queued, is a whole number of bytes.
+static int wave_write_bits(struct file *pfile, const char *ubuf, unsigned int count, unsigned int rate_hz, bool more,
+        unsigned int gen, unsigned int *done)
+{
+    unsigned char kbuf[64];
+    unsigned int bit = 0, start = 0, n = 0;
+    int idx = -1, level = -1, b;
+
+    *done = 0;
+    while(bit < count)
+    {
+        // a byte holds at most 8 run edges, close a nearly full buffer before the next byte
+        // by splitting the current run there, the level carries on into the next buffer
+        if(bit % 8 == 0 && n >= WAVE_BUF - 8)
+        {
+            wave[idx].steps[n].level = level;
+            wave[idx].steps[n].duration_ns = div_u64((u64)bit * NSEC_PER_SEC, rate_hz) - div_u64((u64)start * NSEC_PER_SEC, rate_hz);
+            wave[idx].len = n + 1;
+            if(!wave_submit(idx, true, gen))
+                return -ECANCELED;
+            *done = bit;
+            idx = -1;
+            n = 0;
+            start = bit;
+        }
+        if(bit % (8 * sizeof(kbuf)) == 0 &&
+           copy_from_user(kbuf, ubuf + bit / 8, min((count - bit + 7) / 8, (unsigned int)sizeof(kbuf))))
+            return -EFAULT;
+        b = (kbuf[(bit / 8) % sizeof(kbuf)] >> (7 - bit % 8)) & 1;
+        // start == bit: the run was just ended by the split above
+        if(level >= 0 && b != level && start < bit)
+        {
+            if(idx < 0 && (idx = wave_get(pfile)) < 0)
+                return idx;
+            wave[idx].steps[n].level = level;
+            wave[idx].steps[n].duration_ns = div_u64((u64)bit * NSEC_PER_SEC, rate_hz) - div_u64((u64)start * NSEC_PER_SEC, rate_hz);
+            n++;
+            start = bit;
+        }
+        level = b;
+        bit++;
+    }
+    if(level < 0)
+        return 0;
+    if(idx < 0 && (idx = wave_get(pfile)) < 0)
+        return idx;
+    wave[idx].steps[n].level = level;
+    wave[idx].steps[n].duration_ns = div_u64((u64)count * NSEC_PER_SEC, rate_hz) - div_u64((u64)start * NSEC_PER_SEC, rate_hz);
+    wave[idx].len = n + 1;
+    if(!wave_submit(idx, more, gen))
+        return -ECANCELED;
+    *done = count;
+    return 0;
+}
+
+// returns the header plus the payload queued. a call that fails after queueing part of the
+// waveform returns that part as a short count, so the caller resends only the rest.
+static ssize_t bbb_gpio_write_wave(struct file *pfile, const char *ubuf, size_t size)
+{
+    wave_hdr_t hdr;
+    size_t need, avail = size - sizeof(hdr);
+    unsigned long flags;
+    unsigned int gen, done;
+    int ret;
+
+    if(copy_from_user(&hdr, ubuf, sizeof(hdr)))
+        return -EFAULT;
+    // checked by division, count * sizeof(wave_step_t) may not fit a 32-bit size_t
+    if(hdr.rate_hz ? hdr.count / 8 + (hdr.count % 8 != 0) > avail : hdr.count > avail / sizeof(wave_step_t))
+        return -EINVAL;
+    // a bit period below WAVE_MIN_NS, steps are checked as they are copied
+    if(hdr.rate_hz > NSEC_PER_SEC / WAVE_MIN_NS)
+        return -EINVAL;
+    need = hdr.rate_hz ? hdr.count / 8 + (hdr.count % 8 != 0) : hdr.count * sizeof(wave_step_t);
+
+    pattern_stop();
+    mutex_lock(&wave_mutex);
+    // a '0'/'1' write or a press from here on drops this waveform
+    spin_lock_irqsave(&wave_lock, flags);
+    gen = wave_gen;
+    spin_unlock_irqrestore(&wave_lock, flags);
+    if(hdr.rate_hz)
+        ret = wave_write_bits(pfile, ubuf + sizeof(hdr), hdr.count, hdr.rate_hz, hdr.flags & WAVE_MORE, gen, &done);
+    else
+        ret = wave_write_steps(pfile, ubuf + sizeof(hdr), hdr.count, hdr.flags & WAVE_MORE, gen, &done);
+    mutex_unlock(&wave_mutex);
+    if(ret == -ECANCELED)
+    {
+        // stopped while queueing: the whole write is consumed, resending it would restart playback
+        printk(KERN_INFO "%s: gpio pin %d waveform stopped while queued\n",THIS_MODULE->name,out_gpios[0]);
+        return sizeof(hdr) + need;
+    }
+    if(ret < 0 && done > 0)
+        return sizeof(hdr) + (hdr.rate_hz ? done / 8 : done * sizeof(wave_step_t));
+    if(ret < 0)
+        return ret;
+    printk(KERN_INFO "%s: gpio pin %d waveform of %u %s queued\n",THIS_MODULE->name,out_gpios[0],hdr.count,hdr.rate_hz ? "bits" : "steps");
+    return sizeof(hdr) + need;
+}
+
+#define ev_pending() (smp_load_acquire(&ev_head) != READ_ONCE(ev_tail))
+
+// producer side, isr only: a full ring drops the new edge, the seq gap tells readers
+static void event_push(u64 ts, int edge)
+{
+    unsigned int head = ev_head;
+    gpio_event_t *ev;
+
+    ev_seq++;
+    if(head - smp_load_acquire(&ev_tail) == EVENT_RING)
+    {
+        ev_dropped++;
+        return;
+    }
+    ev = &ev_ring[head & (EVENT_RING - 1)];
+    ev->ts_ns = ts;
+    ev->seq = ev_seq;
+    ev->edge = edge;
+    // the slot must be complete before readers can see it
+    smp_store_release(&ev_head, head + 1);
+    wake_up_interruptible(&ev_wq);
+}
+
+// a confirmed edge: queue it, rising edges also drive the led pattern
+static void switch_edge(u64 ts, int edge)
+{
+    event_push(ts, edge);
+    if(edge != EDGE_RISING)
+        return;
+    if(press_cancels && READ_ONCE(pat_active))
+        pattern_stop();
+    else
+        pattern_start(ts);
+}
+
+// end of the debounce window: the edge counts only if the level really changed.
+// edges while the line was masked are replayed by enable_irq() and open a new window.
+static enum hrtimer_restart db_timer_fn(struct hrtimer *timer)
+{
+    int level = gpiod_get_value(switch_gpiod);
+
+    if(level != db_level)
+    {
+        db_level = level;
+        db_accepted++;
+        switch_edge(db_ts, level ? EDGE_RISING : EDGE_FALLING);
+    }
+    else
+        db_rejected++;
+    enable_irq(irq);
+    return HRTIMER_NORESTART;
+}
+
+// storm mode: sample the line at a bounded rate, each level change is an edge.
+// irqs come back once the level has been stable for storm_quiet_ms.
+static enum hrtimer_restart storm_timer_fn(struct hrtimer *timer)
+{
+    u64 now = ktime_get_ns();
+    int level = gpiod_get_value(switch_gpiod);
+
+    storm_polls++;
+    if(level != storm_level)
+    {
+        storm_level = level;
+        storm_last_change = now;
+        db_level = level;
+        switch_edge(now, level ? EDGE_RISING : EDGE_FALLING);
+    }
+    else if(now - storm_last_change >= (u64)storm_quiet_ms * NSEC_PER_MSEC)
+    {
+        storm_win_start = now;
+        storm_win_irqs = 0;
+        WRITE_ONCE(storm_mode, false);
+        storm_exits++;
+        enable_irq(irq);
+        return HRTIMER_NORESTART;
+    }
+    hrtimer_forward_now(timer, ns_to_ktime((u64)max(storm_poll_us, 1U) * NSEC_PER_USEC));
+    return HRTIMER_RESTART;
+}
+
+// true when this irq pushed the rate over the limit and the line is now polled
+static bool storm_check(u64 ts)
+{
+    if(ts - storm_win_start >= STORM_WINDOW_NS)
+    {
+        storm_irq_hz = div64_u64((u64)storm_win_irqs * NSEC_PER_SEC, ts - storm_win_start);
+        storm_win_start = ts;
+        storm_win_irqs = 0;
+    }
+    storm_win_irqs++;
+    if(storm_irq_rate == 0 || switch_cansleep || storm_win_irqs <= max_t(unsigned long, storm_irq_rate / (NSEC_PER_SEC / STORM_WINDOW_NS), 1))
+        return false;
+
+    disable_irq_nosync(irq);
+    WRITE_ONCE(storm_mode, true);
+    storm_enters++;
+    storm_level = db_level;
+    storm_last_change = ts;
+    hrtimer_start(&storm_timer, ktime_get(), HRTIMER_MODE_ABS);
+    return true;
 }
 
 //irq handler
 static irqreturn_t switch_isr(int irq, void *param)
 {
-    printk(KERN_INFO "%s: switch_isr() called\n",THIS_MODULE->name);
-    schedule_work(&work_queue);
+    u64 ts = ktime_get_ns();
+
+    printk_ratelimited(KERN_INFO "%s: switch_isr() called\n",THIS_MODULE->name);
+    sw_irqs++;
+    lat_isr(ts);
+    if(storm_check(ts))
+        return IRQ_HANDLED;
+    if(db_soft)
+    {
+        // bounces would only re-enter here, mask the line until the window closes
+        disable_irq_nosync(irq);
+        db_ts = ts;
+        hrtimer_start(&db_timer, ns_to_ktime((u64)max(debounce_us, 1U) * NSEC_PER_USEC), HRTIMER_MODE_REL);
+        return IRQ_HANDLED;
+    }
+    if(switch_cansleep)
+        switch_edge(ts, gpiod_get_value_cansleep(switch_gpiod) ? EDGE_RISING : EDGE_FALLING);
+    else
+        switch_edge(ts, gpiod_get_value(switch_gpiod) ? EDGE_RISING : EDGE_FALLING);
     return IRQ_HANDLED;
 }
 
+// whole bytes readers may take
+#define smp_ready() ((smp_load_acquire(&smp_head) - READ_ONCE(smp_tail)) / 8)
+
+static enum hrtimer_restart smp_timer_fn(struct hrtimer *timer)
+{
+    ktime_t expires = hrtimer_get_expires(timer);
+    u64 late = ktime_to_ns(ktime_sub(ktime_get(), expires));
+    unsigned int head = smp_head, bit = head % (8 * SAMPLE_BYTES);
+    unsigned char *byte = &smp_ring[bit / 8];
+    u64 orun;
+
+    if(!READ_ONCE(smp_running))
+        return HRTIMER_NORESTART;
+
+    smp_samples++;
+    smp_jitter_sum += late;
+    if(late > smp_jitter_max)
+        smp_jitter_max = late;
+    if(head - smp_load_acquire(&smp_tail) == 8 * SAMPLE_BYTES)
+        smp_lost++;
+    else
+    {
+        if(gpiod_get_value(switch_gpiod))
+            *byte |= 0x80 >> (bit % 8);
+        else
+            *byte &= ~(0x80 >> (bit % 8));
+        // a byte is published once its last bit is in
+        smp_store_release(&smp_head, head + 1);
+        if(bit % 8 == 7)
+            wake_up_interruptible(&smp_wq);
+    }
+
+    // periods we were too late for are not sampled, only counted
+    orun = hrtimer_forward_now(timer, ns_to_ktime(smp_period_ns));
+    smp_missed += orun - 1;
+    return HRTIMER_RESTART;
+}
+
+// one sampler and one ring: another file's start would reset the owner's ring
+static int sample_start(struct file *pfile, unsigned int rate_hz)
+{
+    if(rate_hz == 0 || rate_hz > sample_max_hz)
+        return -EINVAL;
+    // sampled from the timer, the switch has to be readable from atomic context
+    if(gpiod_cansleep(switch_gpiod))
+        return -EOPNOTSUPP;
+
+    mutex_lock(&smp_lock);
+    if(smp_owner != NULL && smp_owner != pfile)
+    {
+        mutex_unlock(&smp_lock);
+        return -EBUSY;
+    }
+    smp_owner = pfile;
+    WRITE_ONCE(smp_running, false);
+    hrtimer_cancel(&smp_timer);
+    smp_head = smp_tail = 0;
+    smp_samples = smp_lost = smp_missed = smp_jitter_max = smp_jitter_sum = 0;
+    smp_period_ns = div_u64(NSEC_PER_SEC, rate_hz);
+    WRITE_ONCE(smp_running, true);
+    hrtimer_start(&smp_timer, ktime_get(), HRTIMER_MODE_ABS);
+    mutex_unlock(&smp_lock);
+    printk(KERN_INFO "%s: sampling gpio pin %d at %u Hz\n",THIS_MODULE->name,in_gpios[0],rate_hz);
+    return 0;
+}
+
+// pfile NULL stops sampling whoever owns it, for module exit
+static int sample_stop(struct file *pfile)
+{
+    mutex_lock(&smp_lock);
+    if(pfile != NULL && smp_owner != pfile)
+    {
+        mutex_unlock(&smp_lock);
+        return -EBUSY;
+    }
+    smp_owner = NULL;
+    WRITE_ONCE(smp_running, false);
+    hrtimer_cancel(&smp_timer);
+    mutex_unlock(&smp_lock);
+    wake_up_interruptible(&smp_wq);
+    return 0;
+}
+
+static ssize_t sample_read(struct file *pfile, char *ubuf, size_t size)
+{
+    unsigned int tail, off, n, l;
+    int ret;
+
+    if(pfile->f_flags & O_NONBLOCK)
+    {
+        if(smp_ready() == 0)
+            return -EAGAIN;
+    }
+    else
+    {
+        ret = wait_event_interruptible(smp_wq, smp_ready() > 0 || !READ_ONCE(smp_running));
+        if(ret != 0)
+            return -ERESTARTSYS;
+    }
+
+    mutex_lock(&smp_lock);
+    tail = smp_tail;
+    n = min_t(size_t, smp_ready(), size);
+    off = (tail / 8) % SAMPLE_BYTES;
+    l = min(n, SAMPLE_BYTES - off);
+    if(copy_to_user(ubuf, &smp_ring[off], l) || copy_to_user(ubuf + l, &smp_ring[0], n - l))
+    {
+        mutex_unlock(&smp_lock);
+        return -EFAULT;
+    }
+    smp_store_release(&smp_tail, tail + 8 * n);
+    mutex_unlock(&smp_lock);
+    return n;
+}
+
+static ssize_t switch_level_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%d\n", gpiod_get_value_cansleep(switch_gpiod));
+}
+
+static ssize_t events_dropped_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%lu\n", READ_ONCE(ev_dropped));
+}
+
+static ssize_t debounce_stats_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "%s irqs %lu accepted %lu rejected %lu\n", db_soft ? "soft" : "hw",
+            READ_ONCE(sw_irqs), READ_ONCE(db_accepted), READ_ONCE(db_rejected));
+}
+
+static ssize_t wave_stats_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    return sprintf(kbuf, "steps %lu underruns %lu\n", READ_ONCE(wave_steps), READ_ONCE(wave_underruns));
+}
+
+static ssize_t irq_storm_show(struct device *dev, struct device_attribute *attr, char *kbuf)
+{
+    bool polling = READ_ONCE(storm_mode);
+
+    return sprintf(kbuf, "%s irq_hz %lu poll_hz %lu enters %lu exits %lu polls %lu\n", polling ? "poll" : "irq",
+            READ_ONCE(storm_irq_hz), polling ? USEC_PER_SEC / max(storm_poll_us, 1U) : 0UL,
+            READ_ONCE(storm_enters), READ_ONCE(storm_exits), READ_ONCE(storm_polls));
+}
+
+static int latency_show(struct seq_file *m, void *v)
+{
+    struct lat_stage st;
+    unsigned long flags;
+    int i, b;
+
+    for(i=0; i<LAT_STAGES; i++)
+    {
+        spin_lock_irqsave(&lat_lock, flags);
+        st = lat[i];
+        spin_unlock_irqrestore(&lat_lock, flags);
+        seq_printf(m, "%s: count %lu max %llu ns avg %llu ns\n", lat_names[i], st.count,
+                st.max, st.count ? div64_u64(st.sum, st.count) : 0);
+        for(b=0; b<LAT_BUCKETS; b++)
+        {
+            if(st.hist[b] == 0)
+                continue;
+            if(b == LAT_BUCKETS - 1)
+                seq_printf(m, "  >= %lu us: %lu\n", 1UL << (b - 1), st.hist[b]);
+            else
+                seq_printf(m, "  < %lu us: %lu\n", 1UL << b, st.hist[b]);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+// any write clears every stage
+static ssize_t lat_reset_write(struct file *pfile, const char __user *ubuf, size_t size, loff_t *poffset)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&lat_lock, flags);
+    memset(lat, 0, sizeof(lat));
+    lat_stim = 0;
+    lat_work_ts = 0;
+    spin_unlock_irqrestore(&lat_lock, flags);
+    return size;
+}
+
+static const struct file_operations lat_reset_fops = {
+    .owner = THIS_MODULE,
+    .write = lat_reset_write
+};
+
+static DEVICE_ATTR_RO(switch_level);
+static DEVICE_ATTR_RO(events_dropped);
+static DEVICE_ATTR_RO(debounce_stats);
+static DEVICE_ATTR_RO(wave_stats);
+static DEVICE_ATTR_RO(irq_storm);
+
+static struct attribute *bbb_gpio_attrs[] = {
+    &dev_attr_switch_level.attr,
+    &dev_attr_events_dropped.attr,
+    &dev_attr_debounce_stats.attr,
+    &dev_attr_wave_stats.attr,
+    &dev_attr_irq_storm.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(bbb_gpio);
+
+// request a bank by legacy number and keep its descriptors, outputs other than pin 0 start low
+static int bank_request(const int *gpios, int cnt, struct gpio_desc **descs, const char *label, int output, int level)
+{
+    int i, ret;
+
+    for(i=0; i<cnt; i++)
+    {
+        if(!gpio_is_valid(gpios[i]))
+        {
+            printk(KERN_ERR "%s: gpio pin %d not exist\n", THIS_MODULE->name, gpios[i]);
+            ret = -EINVAL;
+            goto bank_failed;
+        }
+        ret = gpio_request(gpios[i], label);
+        if(ret != 0)
+        {
+            printk(KERN_ERR "%s: gpio pin %d is busy\n", THIS_MODULE->name, gpios[i]);
+            goto bank_failed;
+        }
+        descs[i] = gpio_to_desc(gpios[i]);
+        ret = output ? gpiod_direction_output(descs[i], i == 0 ? level : 0) : gpiod_direction_input(descs[i]);
+        if(ret != 0)
+        {
+            printk(KERN_ERR "%s: gpio pin %d direction not set\n", THIS_MODULE->name, gpios[i]);
+            gpio_free(gpios[i]);
+            goto bank_failed;
+        }
+        printk(KERN_INFO "%s: gpio pin %d acquired as %s\n",THIS_MODULE->name, gpios[i], output ? "output" : "input");
+    }
+    return 0;
+
+bank_failed:
+    for(i=i-1; i>=0; i--)
+        gpio_free(gpios[i]);
+    return ret;
+}
+
+static void bank_free(const int *gpios, int cnt)
+{
+    int i;
+
+    for(i=cnt-1; i>=0; i--)
+        gpio_free(gpios[i]);
+}
+
 static __init int init_bbb_gpio(void)
 {
     int ret,minor;
@@ -79,7 +981,7 @@ static __init int init_bbb_gpio(void)
     }
     printk(KERN_INFO "%s : class_create() successfull\n",THIS_MODULE->name);
     
-    pdevice = device_create(pclass,NULL,devno,NULL,"bbb_gpio%d",0);
+    pdevice = device_create_with_groups(pclass,NULL,devno,NULL,bbb_gpio_groups,"bbb_gpio%d",0);
     if(IS_ERR(pdevice))
     {
         printk(KERN_ERR "%s : device_create() failed\n",THIS_MODULE->name);
@@ -96,91 +998,80 @@ static __init int init_bbb_gpio(void)
     }
     printk(KERN_INFO "%s : cdev_add() successfull\n",THIS_MODULE->name);
 
-    // checking for valid gpio led
-    bool valid = gpio_is_valid(LED_GPIO);
-    if(!valid)
-    {
-        printk(KERN_ERR "%s: gpio pin %d not exist\n", THIS_MODULE->name, LED_GPIO);
-        ret = -1;
-        goto gpio_invalid;
-    }
-    printk(KERN_INFO "%s : gpio pin %d exists\n",THIS_MODULE->name, LED_GPIO);
-
-    // requesting for gpio led
-    ret = gpio_request(LED_GPIO, "bbb-led");
-    if(ret != 0)
-    {
-        printk(KERN_ERR "%s: gpio pin %d is busy\n", THIS_MODULE->name, LED_GPIO);
-        goto gpio_invalid;
-    }
-    printk(KERN_INFO "%s : gpio pin %d acquired\n",THIS_MODULE->name, LED_GPIO);
-
-    // led output
+    // led output, starts on
     led_state = 1;
-    ret = gpio_direction_output(LED_GPIO, led_state);
+    ret = bank_request(out_gpios, out_cnt, out_descs, "bbb-led", 1, led_state);
     if(ret != 0)
-    {
-        printk(KERN_ERR "%s: gpio pin %d direction not set\n", THIS_MODULE->name, LED_GPIO);
-        goto gpio_direction_failed;
-    }
-    printk(KERN_INFO "%s : gpio pin %d direction set to output\n",THIS_MODULE->name, LED_GPIO);
+        goto gpio_invalid;
 
-    // switch
-    valid = gpio_is_valid(SWITCH_GPIO);
-    if(!valid)
-    {
-        printk(KERN_ERR "%s: gpio pin %d not exist\n", THIS_MODULE->name, SWITCH_GPIO);
-        ret = -1;
-        goto switch_gpio_invalid;
-    }
-    printk(KERN_INFO "%s: gpio pin %d exists\n",THIS_MODULE->name, SWITCH_GPIO);
-    // switch request
-    ret = gpio_request(SWITCH_GPIO,"bbb-switch");
+    // switch input
+    ret = bank_request(in_gpios, in_cnt, in_descs, "bbb-switch", 0, 0);
     if(ret != 0)
-    {
-        printk(KERN_ERR "%s: gpio pin %d is busy\n",THIS_MODULE->name,SWITCH_GPIO);
         goto switch_gpio_invalid;
-    }
-    printk(KERN_INFO "%s: gpio pin %d acquired\n",THIS_MODULE->name, SWITCH_GPIO);
 
-    // switch input
-    ret = gpio_direction_input(SWITCH_GPIO);
-    if(ret != 0)
+    // everything the isr touches must be ready before request_irq()
+    gpio_wq = alloc_workqueue("bbb_gpio", WQ_HIGHPRI, 0);
+    if(gpio_wq == NULL)
     {
-        printk(KERN_ERR "%s: gpio pin %d direction is not set\n",THIS_MODULE->name, SWITCH_GPIO);
-        goto switch_gpio_direction_failed;
+        printk(KERN_ERR "%s: alloc_workqueue() failed\n",THIS_MODULE->name);
+        ret = -ENOMEM;
+        goto workqueue_alloc_failed;
     }
-    printk(KERN_INFO "%s: gpio pin %d direction set to input\n",THIS_MODULE->name,SWITCH_GPIO);
+    INIT_WORK(&work_queue,work_handler);
+    led_cansleep = gpiod_cansleep(led_gpiod);
+    switch_cansleep = gpiod_cansleep(switch_gpiod);
+    hrtimer_init(&pat_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    pat_timer.function = pat_timer_fn;
+    hrtimer_init(&wave_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    wave_timer.function = wave_timer_fn;
+    hrtimer_init(&smp_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    smp_timer.function = smp_timer_fn;
+    printk(KERN_INFO "%s: work_queue is initialized\n",THIS_MODULE->name);
 
     // set SWITCH debouncing delay
-	ret = gpio_set_debounce(SWITCH_GPIO, 40);
+	ret = soft_debounce == 1 ? -ENOTSUPP : gpiod_set_debounce(switch_gpiod, debounce_us);
 	if(ret < 0)
-		printk(KERN_ERR "%s: failed to set gpio pin %d debouncing delay.\n", THIS_MODULE->name, SWITCH_GPIO);
+		printk(KERN_ERR "%s: failed to set gpio pin %d debouncing delay.\n", THIS_MODULE->name, in_gpios[0]);
 	else
 		printk(KERN_INFO "%s: SWITCH gpio pin debouncing delay is set.\n", THIS_MODULE->name);
+    db_soft = ret < 0 && soft_debounce != 0 && !switch_cansleep;
+    db_level = gpiod_get_value_cansleep(switch_gpiod);
+    hrtimer_init(&db_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    db_timer.function = db_timer_fn;
+    hrtimer_init(&storm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    storm_timer.function = storm_timer_fn;
+    if(db_soft)
+        printk(KERN_INFO "%s: SWITCH gpio pin debounced in software, %u us window.\n", THIS_MODULE->name, debounce_us);
 
     // GET THE GPIO intr no
-    irq = gpio_to_irq(SWITCH_GPIO);
-    ret = request_irq(irq, switch_isr, IRQF_TRIGGER_RISING,"bbb_switch",NULL);
+    irq = gpiod_to_irq(switch_gpiod);
+    // both edges go to the event ring, only rising edges drive the led pattern
+    // a switch behind a sleeping controller can only be read from the irq thread
+    if(switch_cansleep)
+        ret = request_threaded_irq(irq, NULL, switch_isr, IRQF_ONESHOT | IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,"bbb_switch",NULL);
+    else
+        ret = request_irq(irq, switch_isr, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,"bbb_switch",NULL);
     if(ret != 0)
     {
-        printk(KERN_ERR "%s: gpio pin %d isr register failed\n",THIS_MODULE->name, SWITCH_GPIO);
-        goto switch_gpio_direction_failed;
+        printk(KERN_ERR "%s: gpio pin %d isr register failed\n",THIS_MODULE->name, in_gpios[0]);
+        goto request_irq_failed;
     }
-    printk(KERN_INFO "%s: gpio pin %d registerd isr on irq line %d\n",THIS_MODULE->name, SWITCH_GPIO, irq);
+    printk(KERN_INFO "%s: gpio pin %d registerd isr on irq line %d\n",THIS_MODULE->name, in_gpios[0], irq);
 
-    //tasklet_init(&tasklet, tasklet_handler, 0);
-    INIT_WORK(&work_queue,work_handler);
-    printk(KERN_INFO "%s: work_queue is initialized\n",THIS_MODULE->name);
+    // debug only, the driver works without it
+    lat_dir = debugfs_create_dir("bbb_gpio", NULL);
+    debugfs_create_file("latency", 0444, lat_dir, NULL, &latency_fops);
+    debugfs_create_file("reset", 0200, lat_dir, NULL, &lat_reset_fops);
 
     printk(KERN_INFO "%s : init_mod() completed\n",THIS_MODULE->name);
     return 0;
 
-switch_gpio_direction_failed:
-    gpio_free(SWITCH_GPIO);
+request_irq_failed:
+    destroy_workqueue(gpio_wq);
+workqueue_alloc_failed:
+    bank_free(in_gpios, in_cnt);
 switch_gpio_invalid:
-gpio_direction_failed:
-    gpio_free(LED_GPIO);
+    bank_free(out_gpios, out_cnt);
 gpio_invalid:
     cdev_del(&cdev);
 cdev_add_failed:
@@ -197,15 +1088,31 @@ alloc_chrdev_region_failed:
 static __exit void exit_bbb_gpio(void)
 {
     printk(KERN_INFO "%s : exit_mod() called\n",THIS_MODULE->name);
+    debugfs_remove_recursive(lat_dir);
 
+    // no new windows once the line is off. a window cancelled before it ran never
+    // re-enabled the line, undo its disable_irq_nosync() here.
+    disable_irq(irq);
+    if(hrtimer_cancel(&db_timer))
+        enable_irq(irq);
+    hrtimer_cancel(&storm_timer);
+    if(storm_mode)
+        enable_irq(irq);
     free_irq(irq,NULL);
-    printk(KERN_INFO "%s : gpio pin %d isr relased\n",THIS_MODULE->name, SWITCH_GPIO);
+    printk(KERN_INFO "%s : gpio pin %d isr relased\n",THIS_MODULE->name, in_gpios[0]);
+
+    // no isr left to restart it
+    hrtimer_cancel(&pat_timer);
+    hrtimer_cancel(&wave_timer);
+    sample_stop(NULL);
+    destroy_workqueue(gpio_wq);
+    printk(KERN_INFO "%s : pattern timer and workqueue released\n",THIS_MODULE->name);
     
-    gpio_free(SWITCH_GPIO);
-    printk(KERN_INFO "%s : gpio pin %d relased\n",THIS_MODULE->name, SWITCH_GPIO);
+    bank_free(in_gpios, in_cnt);
+    printk(KERN_INFO "%s : gpio pin %d relased\n",THIS_MODULE->name, in_gpios[0]);
 
-    gpio_free(LED_GPIO);
-    printk(KERN_INFO "%s : gpio pin %d relased\n",THIS_MODULE->name, LED_GPIO);
+    bank_free(out_gpios, out_cnt);
+    printk(KERN_INFO "%s : gpio pin %d relased\n",THIS_MODULE->name, out_gpios[0]);
     
     cdev_del(&cdev);
     printk(KERN_INFO "%s : cdev_del() device removed\n",THIS_MODULE->name);
@@ -225,59 +1132,229 @@ static __exit void exit_bbb_gpio(void)
 static int bbb_gpio_open(struct inode *pinode, struct file *pfile)
 {
     printk(KERN_INFO "%s : bbb_gpio_open() called\n",THIS_MODULE->name);
+    pfile->private_data = kzalloc(sizeof(struct bbb_file), GFP_KERNEL);
+    if(pfile->private_data == NULL)
+        return -ENOMEM;
     return 0;
 }
 
 static int bbb_gpio_close(struct inode *pinode, struct file *pfile)
 {
     printk(KERN_INFO "%s : bbb_gpio_close() called\n",THIS_MODULE->name);
+    if(((struct bbb_file *)pfile->private_data)->samples)
+        sample_stop(pfile);
+    kfree(pfile->private_data);
     return 0;
 }
 
+// returns whole gpio_event_t records, as many as fit, the current level is in sysfs switch_level
 static ssize_t bbb_gpio_read(struct file *pfile, char *ubuf, size_t size, loff_t *poffset)
 {
-    int ret, switch_state;
-    char kbuf[4];
+    unsigned int tail, off, n, l;
+    unsigned long flags;
+    bool slept = false;
+    int ret;
 
-    
-    switch_state = gpio_get_value(SWITCH_GPIO);
     printk(KERN_INFO "%s : bbb_gpio_read() called\n",THIS_MODULE->name);
+    if(((struct bbb_file *)pfile->private_data)->samples)
+        return sample_read(pfile, ubuf, size);
+    if(size < sizeof(gpio_event_t))
+        return -EINVAL;
 
-    sprintf(kbuf, "%d\n", switch_state);
-    ret = 2 - copy_to_user(ubuf, kbuf, 2);
-    printk(KERN_INFO "%s : gpio pin %d switch state read = %d\n",THIS_MODULE->name,SWITCH_GPIO,switch_state);
+    if(pfile->f_flags & O_NONBLOCK)
+    {
+        if(!ev_pending())
+            return -EAGAIN;
+    }
+    else
+    {
+        // only a reader that waited measures wake-up latency, a backlog is not latency
+        slept = !ev_pending();
+        ret = wait_event_interruptible(ev_wq, ev_pending());
+        if(ret != 0)
+        {
+            printk(KERN_INFO "%s : bbb_gpio_read() wake-up due to signal\n",THIS_MODULE->name);
+            return -ERESTARTSYS;
+        }
+    }
 
-    return ret;
+    mutex_lock(&ev_lock);
+    // slots between tail and head belong to us until ev_tail moves, copy them in place
+    tail = ev_tail;
+    n = min_t(size_t, smp_load_acquire(&ev_head) - tail, size / sizeof(gpio_event_t));
+    off = tail & (EVENT_RING - 1);
+    l = min(n, EVENT_RING - off);
+    if(copy_to_user(ubuf, &ev_ring[off], l * sizeof(gpio_event_t)) ||
+       copy_to_user(ubuf + l * sizeof(gpio_event_t), &ev_ring[0], (n - l) * sizeof(gpio_event_t)))
+    {
+        mutex_unlock(&ev_lock);
+        return -EFAULT;
+    }
+    if(slept && n > 0)
+    {
+        spin_lock_irqsave(&lat_lock, flags);
+        lat_record(LAT_READER, ktime_get_ns() - ev_ring[off].ts_ns);
+        spin_unlock_irqrestore(&lat_lock, flags);
+    }
+    smp_store_release(&ev_tail, tail + n);
+    mutex_unlock(&ev_lock);
+    printk(KERN_INFO "%s : bbb_gpio_read() returned %u switch events\n",THIS_MODULE->name,n);
+
+    return n * sizeof(gpio_event_t);
 }
 
+static __poll_t bbb_gpio_poll(struct file *pfile, poll_table *wait)
+{
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    if(((struct bbb_file *)pfile->private_data)->samples)
+    {
+        poll_wait(pfile, &smp_wq, wait);
+        if(smp_ready() > 0)
+            mask |= EPOLLIN | EPOLLRDNORM;
+        return mask;
+    }
+    poll_wait(pfile, &ev_wq, wait);
+    if(ev_pending())
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
+
+// '0'/'1' sets the led, a wave_hdr_t starts a waveform
 static ssize_t bbb_gpio_write(struct file *pfile, const char *ubuf, size_t size, loff_t *poffset)
 {
     int ret;
     char kbuf[2] = "";
+    unsigned int magic;
 
     printk(KERN_INFO "%s : bbb_gpio_write() called\n",THIS_MODULE->name);
+
+    if(size >= sizeof(wave_hdr_t))
+    {
+        if(copy_from_user(&magic, ubuf, sizeof(magic)))
+            return -EFAULT;
+        if(magic == WAVE_MAGIC)
+            return bbb_gpio_write_wave(pfile, ubuf, size);
+    }
     
     ret = 1- copy_from_user(kbuf, ubuf, 1);
     if(ret > 0)
     {
         if(kbuf[0]=='1')
         {
-            led_state = 1;
-            gpio_set_value(LED_GPIO,1);
-            printk(KERN_INFO "%s: gpio pin %d led on\n",THIS_MODULE->name,LED_GPIO);
+            pattern_stop();
+            wave_stop();
+            led_apply(1);
+            printk(KERN_INFO "%s: gpio pin %d led on\n",THIS_MODULE->name,out_gpios[0]);
         }
         else if(kbuf[0]=='0')
         {
-            led_state = 0;
-            gpio_set_value(LED_GPIO,0);
-            printk(KERN_INFO "%s: gpio pin %d led off\n",THIS_MODULE->name,LED_GPIO);
+            pattern_stop();
+            wave_stop();
+            led_apply(0);
+            printk(KERN_INFO "%s: gpio pin %d led off\n",THIS_MODULE->name,out_gpios[0]);
         }
         else
-            printk(KERN_INFO "%s: gpio pin %d led no state change\n",THIS_MODULE->name,LED_GPIO);
+            printk(KERN_INFO "%s: gpio pin %d led no state change\n",THIS_MODULE->name,out_gpios[0]);
     }
     return size;
 }
 
+static long bbb_gpio_ioctl(struct file *pfile, unsigned int cmd, unsigned long param)
+{
+    struct bbb_file *pf = (struct bbb_file *)pfile->private_data;
+    DECLARE_BITMAP(vals, BANK_MAX);
+    struct gpio_desc *descs[BANK_MAX];
+    bank_info_t info;
+    bank_t bank;
+    sample_stats_t st;
+    unsigned int bits, rate;
+    int i, n, ret;
+
+    switch(cmd)
+    {
+        case BANK_INFO:
+            printk(KERN_INFO "%s: ioctl() bank info\n",THIS_MODULE->name);
+            info.out_cnt = out_cnt;
+            info.in_cnt = in_cnt;
+            if(copy_to_user((void*)param, &info, sizeof(info)))
+                return -EFAULT;
+            return 0;
+
+        case BANK_GET_IN:
+        case BANK_GET_OUT:
+            printk(KERN_INFO "%s: ioctl() bank get\n",THIS_MODULE->name);
+            bitmap_zero(vals, BANK_MAX);
+            if(cmd == BANK_GET_IN)
+                ret = gpiod_get_array_value_cansleep(in_cnt, in_descs, NULL, vals);
+            else
+                ret = gpiod_get_array_value_cansleep(out_cnt, out_descs, NULL, vals);
+            if(ret < 0)
+                return ret;
+            bits = vals[0];
+            if(copy_to_user((void*)param, &bits, sizeof(bits)))
+                return -EFAULT;
+            return 0;
+
+        case BANK_SET_OUT:
+            printk(KERN_INFO "%s: ioctl() bank set\n",THIS_MODULE->name);
+            if(copy_from_user(&bank, (void*)param, sizeof(bank)))
+                return -EFAULT;
+            // gather the masked pins, gpiolib then updates each chip with one set_multiple()
+            bitmap_zero(vals, BANK_MAX);
+            for(i=0, n=0; i<out_cnt; i++)
+            {
+                if(!(bank.mask & (1U << i)))
+                    continue;
+                descs[n] = out_descs[i];
+                if(bank.values & (1U << i))
+                    __set_bit(n, vals);
+                n++;
+            }
+            if(n == 0)
+                return 0;
+            if(bank.mask & 1)
+            {
+                pattern_stop();
+                wave_stop();
+                WRITE_ONCE(led_state, bank.values & 1);
+                lat_stimulus();
+            }
+            return gpiod_set_array_value_cansleep(n, descs, NULL, vals);
+
+        case SAMPLE_START:
+            printk(KERN_INFO "%s: ioctl() sample start\n",THIS_MODULE->name);
+            if(copy_from_user(&rate, (void*)param, sizeof(rate)))
+                return -EFAULT;
+            ret = sample_start(pfile, rate);
+            if(ret == 0)
+                pf->samples = true;
+            return ret;
+
+        case SAMPLE_STOP:
+            printk(KERN_INFO "%s: ioctl() sample stop\n",THIS_MODULE->name);
+            ret = sample_stop(pfile);
+            if(ret == 0)
+                pf->samples = false;
+            return ret;
+
+        case SAMPLE_STATS:
+            printk(KERN_INFO "%s: ioctl() sample stats\n",THIS_MODULE->name);
+            st.samples = READ_ONCE(smp_samples);
+            st.lost = READ_ONCE(smp_lost);
+            st.missed = READ_ONCE(smp_missed);
+            st.max_jitter_ns = READ_ONCE(smp_jitter_max);
+            st.avg_jitter_ns = st.samples ? div64_u64(READ_ONCE(smp_jitter_sum), st.samples) : 0;
+            if(copy_to_user((void*)param, &st, sizeof(st)))
+                return -EFAULT;
+            return 0;
+
+        default:
+            printk(KERN_INFO "%s: ioctl() unsupported cmd\n",THIS_MODULE->name);
+            return -EINVAL;
+    }
+}
+
 module_init(init_bbb_gpio);
 module_exit(exit_bbb_gpio);
 